@@ -1,48 +1,311 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
 #include <time.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include "debug.h"
 #include "parse_options.h"
 
+/*
+   Every thread puts its formatted messages into its own ring, the log
+   thread adds the time and writes them to the file.  The writer never
+   waits: when its ring is full the message is dropped and counted.
+   Until the log thread is started (and for messages too long for a
+   ring) the writer prints to the file itself.
+*/
+
+struct log_rec
+{
+	size_t      len;        // text bytes
+	int         level;
+	time_t      time;
+	long        thread;
+};
+
+struct log_ring
+{
+	char                *buf;
+	size_t              head;       // written by the owner
+	size_t              tail;       // written by the log thread
+	unsigned long long  dropped;    // written by the owner
+	unsigned long long  reported;
+	int                 used;
+	struct log_ring     *next;
+};
+
 static pthread_mutex_t debug_lock;
 
+static struct log_ring *rings = 0;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rings_key;
+static __thread struct log_ring *self = 0;
+
+static int started = 0;
+static int sleeping = 0;
+static sem_t wake;
+
+#define REC_SIZE(len) \
+	((sizeof(struct log_rec) + (len) + 7) & ~(size_t)7)
+
 void mhdd_debug_init(void)
 {
 	pthread_mutex_init(&debug_lock, 0);
 }
 
-int mhdd_debug(int level, const char *fmt, ...)
+static void print_rec(FILE *out, struct log_rec *rec, const char *text)
 {
-	if (level<mhdd.loglevel) return 0;
-	if (!mhdd.debug) return 0;
+	static time_t last = 0;
+	static char tstr[64];
+	struct tm lt;
+
+	/* most of the records are in the same second */
+	if (rec->time != last) {
+		localtime_r(&rec->time, &lt);
+		strftime(tstr, 64, "%Y-%m-%d %H:%M:%S", &lt);
+		last = rec->time;
+	}
+
+	fprintf(out, "mhddfs [%s]", tstr);
+
+	switch(rec->level)
+	{
+		case MHDD_DEBUG: fprintf(out, " (debug): "); break;
+		case MHDD_INFO:  fprintf(out, " (info): ");  break;
+		default:         fprintf(out, ": ");  break;
+	}
+
+	fprintf(out, "[%ld] ", rec->thread);
+	fwrite(text, 1, rec->len, out);
+}
+
+static void ring_exit(void *data)
+{
+	struct log_ring *ring = data;
+
+	pthread_mutex_lock(&rings_lock);
+	ring->used = 0;
+	pthread_mutex_unlock(&rings_lock);
+}
+
+static struct log_ring * get_ring(void)
+{
+	struct log_ring *ring;
+
+	if (self)
+		return self;
+
+	pthread_mutex_lock(&rings_lock);
+	for (ring = rings; ring && ring->used; ring = ring->next);
+	if (!ring) {
+		ring = calloc(1, sizeof(struct log_ring));
+		ring->buf = malloc(MHDD_LOG_RING);
+		ring->next = rings;
+		rings = ring;
+	}
+	ring->used = 1;
+	pthread_mutex_unlock(&rings_lock);
+
+	pthread_setspecific(rings_key, ring);
+	self = ring;
+	return ring;
+}
+
+static void ring_copy(char *dst, const struct log_ring *ring, size_t pos,
+	size_t len)
+{
+	size_t off = pos % MHDD_LOG_RING, first = MHDD_LOG_RING - off;
+
+	if (first > len)
+		first = len;
+	memcpy(dst, ring->buf + off, first);
+	memcpy(dst + first, ring->buf, len - first);
+}
+
+static void ring_put(struct log_ring *ring, size_t pos, const void *src,
+	size_t len)
+{
+	size_t off = pos % MHDD_LOG_RING, first = MHDD_LOG_RING - off;
+
+	if (first > len)
+		first = len;
+	memcpy(ring->buf + off, src, first);
+	memcpy(ring->buf, (const char *)src + first, len - first);
+}
 
+// 0 - the ring is full
+static int ring_push(struct log_ring *ring, struct log_rec *rec,
+	const char *text)
+{
+	size_t head = ring->head;
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
 
-	char tstr[64];
-	time_t t=time(0);
-	struct tm *lt;
-	lt=localtime(&t);
+	if (MHDD_LOG_RING - (head - tail) < REC_SIZE(rec->len)) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1,
+			__ATOMIC_RELAXED);
+		return 0;
+	}
+	ring_put(ring, head, rec, sizeof(struct log_rec));
+	ring_put(ring, head + sizeof(struct log_rec), text, rec->len);
+	__atomic_store_n(&ring->head, head + REC_SIZE(rec->len),
+		__ATOMIC_RELEASE);
+	return 1;
+}
 
+// write out the records of all the rings, return their count
+static int drain(void)
+{
+	struct log_ring *ring;
+	struct log_rec rec;
+	unsigned long long dropped;
+	size_t head, size = 0, outlen;
+	char *text = 0, *outbuf;
+	int count = 0;
+	FILE *out;
 
-	strftime(tstr, 64, "%Y-%m-%d %H:%M:%S", lt);
+	/* the log file is unbuffered, a batch goes in one write */
+	if (!(out = open_memstream(&outbuf, &outlen)))
+		return 0;
 
+	pthread_mutex_lock(&rings_lock);
 	pthread_mutex_lock(&debug_lock);
-	fprintf(mhdd.debug, "mhddfs [%s]", tstr);
+	for (ring = rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		while (ring->tail != head) {
+			ring_copy((char *)&rec, ring, ring->tail,
+				sizeof(struct log_rec));
+			if (rec.len > size) {
+				size = rec.len;
+				text = realloc(text, size);
+			}
+			ring_copy(text, ring, ring->tail +
+				sizeof(struct log_rec), rec.len);
+			print_rec(out, &rec, text);
+			__atomic_store_n(&ring->tail,
+				ring->tail + REC_SIZE(rec.len),
+				__ATOMIC_RELEASE);
+			count++;
+		}
 
-	switch(level)
-	{
-		case MHDD_DEBUG: fprintf(mhdd.debug, " (debug): "); break;
-		case MHDD_INFO:  fprintf(mhdd.debug, " (info): ");  break;
-		default:         fprintf(mhdd.debug, ": ");  break;
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->reported) {
+			fprintf(out, "mhddfs: %llu log messages "
+				"dropped\n", dropped - ring->reported);
+			ring->reported = dropped;
+		}
 	}
+	fclose(out);
+	if (outlen)
+		fwrite(outbuf, 1, outlen, mhdd.debug);
+	pthread_mutex_unlock(&debug_lock);
+	pthread_mutex_unlock(&rings_lock);
+	free(outbuf);
+	free(text);
+	return count;
+}
 
-	fprintf(mhdd.debug, "[%ld] ", (long int)pthread_self());
+static void * log_thread(void * arg)
+{
+	struct timespec ts;
 
+	for (;;) {
+		if (drain())
+			continue;
+
+		/* writers post only when they see the thread sleeping */
+		__atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+		if (drain()) {
+			__atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		while (sem_timedwait(&wake, &ts) == -1 && errno == EINTR);
+		__atomic_store_n(&sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+	return 0;
+}
+
+void mhdd_debug_start(void)
+{
+	pthread_t thread;
+
+	if (!mhdd.debug || started)
+		return;
+
+	pthread_key_create(&rings_key, ring_exit);
+	sem_init(&wake, 0, 0);
+	if (pthread_create(&thread, 0, log_thread, 0) != 0) {
+		mhdd_debug(MHDD_MSG, "mhdd_debug_start: can not start "
+			"thread: %s\n", strerror(errno));
+		return;
+	}
+	pthread_detach(thread);
+	__atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+}
+
+void mhdd_debug_flush(void)
+{
+	if (started)
+		drain();
+}
+
+unsigned long long mhdd_debug_dropped(void)
+{
+	struct log_ring *ring;
+	unsigned long long dropped = 0;
+
+	pthread_mutex_lock(&rings_lock);
+	for (ring = rings; ring; ring = ring->next)
+		dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rings_lock);
+	return dropped;
+}
+
+int (mhdd_debug)(int level, const char *fmt, ...)
+{
+	if (level<mhdd.loglevel) return 0;
+	if (!mhdd.debug) return 0;
+
+	char line[MHDD_LOG_LINE], *text = line;
+	struct log_rec rec;
 	va_list ap;
+	int res;
+
 	va_start(ap, fmt);
-	int res=vfprintf(mhdd.debug, fmt, ap);
+	res = vsnprintf(line, MHDD_LOG_LINE, fmt, ap);
 	va_end(ap);
-	pthread_mutex_unlock(&debug_lock);
+	if (res < 0)
+		return res;
+	if (res >= MHDD_LOG_LINE) {
+		text = malloc(res + 1);
+		va_start(ap, fmt);
+		vsnprintf(text, res + 1, fmt, ap);
+		va_end(ap);
+	}
+
+	rec.len = res;
+	rec.level = level;
+	rec.time = time(0);
+	rec.thread = (long int)pthread_self();
+
+	if (__atomic_load_n(&started, __ATOMIC_ACQUIRE) &&
+			REC_SIZE(res) <= MHDD_LOG_RING / 4) {
+		ring_push(get_ring(), &rec, text);
+		if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) &&
+				__atomic_exchange_n(&sleeping, 0,
+					__ATOMIC_SEQ_CST))
+			sem_post(&wake);
+	} else {
+		pthread_mutex_lock(&debug_lock);
+		print_rec(mhdd.debug, &rec, text);
+		pthread_mutex_unlock(&debug_lock);
+	}
+
+	if (text != line)
+		free(text);
 	return res;
 }
-
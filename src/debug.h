@@ -7,8 +7,28 @@
 #define MHDD_INFO   1
 #define MHDD_MSG    2
 
+// messages below the level are not compiled in (make LOG_MIN_LEVEL=x)
+#ifndef MHDD_LOG_MIN_LEVEL
+#define MHDD_LOG_MIN_LEVEL MHDD_DEBUG
+#endif
+
+// bytes of the message ring of each thread
+#define MHDD_LOG_RING 65536
+// messages longer than it are formatted in malloced memory
+#define MHDD_LOG_LINE 1024
 
 int mhdd_debug(int level, const char *fmt, ...);
 void mhdd_debug_init(void);
+// start the log thread (after fork), until then messages are written
+// by the callers
+void mhdd_debug_start(void);
+// write out the queued messages
+void mhdd_debug_flush(void);
+// messages lost because of the full rings
+unsigned long long mhdd_debug_dropped(void);
+
+#define mhdd_debug(level, ...) \
+	((level) < MHDD_LOG_MIN_LEVEL ? (void)0 : \
+		(void)mhdd_debug(level, __VA_ARGS__))
 
 #endif
@@ -10,12 +10,21 @@
 #include <fcntl.h>
 
 #include "flist.h"
+#include "uring.h"
 #include "debug.h"
 
-static struct flist *files = 0;
+// items with the same name
+struct flist_name
+{
+	char            *name;
+	struct flist    *items;
+	int             count;
+	UT_hash_handle  hh;
+};
 
-#define flist_foreach(__next) \
-	for(__next = files; __next; __next = __next->next)
+static struct flist *files = 0;
+static struct flist_name *names = 0;
+static uint64_t last_id = 0;
 
 
 enum { UNLOCKED, RDLOCKED, WRLOCKED };
@@ -55,6 +64,48 @@ void flist_wrlock_locked(void)
 	pthread_rwlock_wrlock(&files_lock);
 }
 
+/* add item to the name group (wrlocked) */
+static void group_add(struct flist * item)
+{
+	struct flist_name * group;
+
+	HASH_FIND_STR(names, item->name, group);
+	if (!group) {
+		group = calloc(1, sizeof(struct flist_name));
+		group->name = strdup(item->name);
+		HASH_ADD_KEYPTR(hh, names, group->name,
+			strlen(group->name), group);
+	}
+
+	item->group = group;
+	item->gprev = 0;
+	item->gnext = group->items;
+	if (group->items)
+		group->items->gprev = item;
+	group->items = item;
+	group->count++;
+}
+
+/* remove item from its name group (wrlocked) */
+static void group_del(struct flist * item)
+{
+	struct flist_name * group = item->group;
+
+	if (item->gnext)
+		item->gnext->gprev = item->gprev;
+	if (item->gprev)
+		item->gprev->gnext = item->gnext;
+	else
+		group->items = item->gnext;
+	item->group = 0;
+
+	if (--group->count)
+		return;
+	HASH_DEL(names, group);
+	free(group->name);
+	free(group);
+}
+
 // add file to list
 struct flist * flist_create(const char *name,
 		const char *real_name, int flags, int fh)
@@ -62,62 +113,129 @@ struct flist * flist_create(const char *name,
 	struct flist * add = calloc(1, sizeof(struct flist));
 
 	add->flags = flags;
-	add->id = 0;
-	add->aid = add;
 	add->name = strdup(name);
 	add->real_name = strdup(real_name);
 	add->fh = fh;
+	add->dir_id = -1;
 
 	flist_wrlock();
-	add->next = files;
-	if (files)
-		files->prev = add;
-	files = add;
+	add->id = ++last_id;
+	HASH_ADD(hh, files, id, sizeof(uint64_t), add);
+	group_add(add);
+	uring_register(fh);
 	return add;
 }
 
-/* return (malloced) array for list files with name == name */
-struct flist ** flist_items_by_eq_name(struct flist * info)
+static struct flist ** group_items(struct flist_name * group)
 {
 	struct flist * next;
 	struct flist ** result;
-	int i = 0, count = 0;
+	int i = 0;
+
+	result=calloc(group->count+1, sizeof(struct flist *));
 
+	for (next = group->items; next; next = next->gnext)
+		result[i++] = next;
+	return result;
+}
+
+/* return (malloced) array for list files with name == name */
+struct flist ** flist_items_by_eq_name(struct flist * info)
+{
 	mhdd_debug(MHDD_INFO, "flist_items_by_eq_name: %s\n", info->name);
 
-	flist_foreach(next)
-		count++;
+	if (!info->group)
+		return 0;
+	return group_items(info->group);
+}
+
+/* the same by name, 0 if the file isn't opened */
+struct flist ** flist_items_by_name(const char *name)
+{
+	struct flist_name * group;
 
-	if (!count)
+	HASH_FIND_STR(names, name, group);
+	if (!group)
 		return 0;
+	return group_items(group);
+}
 
+/* replace name prefix (len bytes) of item by to */
+static void rename_item(struct flist * item, size_t len, const char *to)
+{
+	const char *tail = item->name + len;
+	const char *vfrom = item->name, *vto = to;
+	size_t plen;
+	char *name, *real_name;
+
+	/* real_name is the dir prefix + name without leading '/' */
+	while (*vfrom == '/') vfrom++;
+	while (*vto == '/') vto++;
+	plen = strlen(item->real_name) - strlen(vfrom);
+
+	name = calloc(strlen(to) + strlen(tail) + 1, sizeof(char));
+	sprintf(name, "%s%s", to, tail);
+
+	real_name = calloc(plen + strlen(vto) + strlen(tail) + 1,
+		sizeof(char));
+	memcpy(real_name, item->real_name, plen);
+	sprintf(real_name + plen, "%s%s", vto, tail);
+
+	mhdd_debug(MHDD_DEBUG, "flist_rename: %s (%s) -> %s (%s)\n",
+		item->name, item->real_name, name, real_name);
+
+	group_del(item);
+	free(item->name);
+	free(item->real_name);
+	item->name = name;
+	item->real_name = real_name;
+	group_add(item);
+}
 
-	result=calloc(count+1, sizeof(struct flist *));
+static void rename_group(struct flist_name * group, size_t len,
+	const char *to)
+{
+	/* the group is freed with its last item */
+	int count = group->count;
+	while (count--)
+		rename_item(group->items, len, to);
+}
 
-	flist_foreach(next) {
-		if (strcmp(info->name, next->name) == 0)
-			result[i++] = next;
-	}
+/* rename opened files */
+void flist_rename(const char *from, const char *to, int is_dir)
+{
+	struct flist_name * group, * tmp;
+	size_t len = strlen(from);
 
-	if (!result[0]) {
-		free(result);
-		return 0;
+	flist_wrlock();
+	HASH_FIND_STR(names, from, group);
+	if (group)
+		rename_group(group, len, to);
+
+	/* files below the directory */
+	if (is_dir) {
+		HASH_ITER(hh, names, group, tmp) {
+			if (strncmp(group->name, from, len) != 0)
+				continue;
+			if (group->name[len] != '/')
+				continue;
+			rename_group(group, len, to);
+		}
 	}
-	return result;
+	flist_unlock();
 }
 
 /* return (wr- or rdlocked) item by id */
 static struct flist * item_by_id(uint64_t id, int wrlock)
 {
-	struct flist * next;
+	struct flist * item;
 	if (wrlock)
 		flist_wrlock();
 	else
 		flist_rdlock();
-	flist_foreach(next) {
-		if (next->id == id)
-			return next;
-	}
+	HASH_FIND(hh, files, &id, sizeof(uint64_t), item);
+	if (item)
+		return item;
 	flist_unlock();
 	return 0;
 }
@@ -140,28 +258,23 @@ static void delete_item(struct flist *item, int locked)
 	switch(locked) {
 		case UNLOCKED:
 			flist_wrlock();
+			break;
 		case RDLOCKED:
 			flist_wrlock_locked();
 		case WRLOCKED:
 			break;
 	}
 
-	flist_foreach(next) {
-		if (next == item) {
-			if (item->next)
-				item->next->prev = item->prev;
-			if (item->prev)
-				item->prev->next = item->next;
-			if (files==item)
-				files = item->next;
-
-			mhdd_debug(MHDD_DEBUG, "delete_item: %s (%s)\n",
-					item->name, item->real_name);
-			free(item->name);
-			free(item->real_name);
-			free(item);
-			break;
-		}
+	HASH_FIND(hh, files, &item->id, sizeof(uint64_t), next);
+	if (next == item) {
+		HASH_DEL(files, item);
+		group_del(item);
+
+		mhdd_debug(MHDD_DEBUG, "delete_item: %s (%s)\n",
+				item->name, item->real_name);
+		free(item->name);
+		free(item->real_name);
+		free(item);
 	}
 	flist_unlock();
 }
@@ -1,19 +1,26 @@
+#ifndef __FLIST__H__
+#define __FLIST__H__
+
 #include <pthread.h>
 #include <stdint.h>
 
-// opened file list
+#include <uthash.h>
+
+struct flist_name;
+
+// opened file list (hashed by id and grouped by name)
 struct flist
 {
 	char        *name;
 	char        *real_name;
 	int         flags;
 	int         fh;
-	union
-	{
-		uint64_t    id;
-		struct flist *aid;
-	};
-	struct flist *next, *prev;
+	int         dir_id;     // index in mhdd.dirs
+	uint64_t    id;
+	UT_hash_handle hh;
+
+	struct flist_name *group;
+	struct flist *gnext, *gprev;
 };
 
 
@@ -34,6 +41,12 @@ struct flist * flist_item_by_id_wrlock(uint64_t id);
 // return all items by item
 struct flist ** flist_items_by_eq_name(struct flist * info);
 
+// return all items by name
+struct flist ** flist_items_by_name(const char *name);
+
+// rename items (and items below the directory) from -> to
+void flist_rename(const char *from, const char *to, int is_dir);
+
 // delete item from locked list
 void flist_delete_locked(struct flist * item);
 
@@ -49,3 +62,5 @@ void flist_unlock(void);
 
 // wrlock
 void flist_wrlock_locked(void);
+
+#endif
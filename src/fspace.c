@@ -0,0 +1,318 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fspace.h"
+#include "debug.h"
+#include "parse_options.h"
+
+/*
+   Placement reads the free space from memory.  Between the refreshes
+   the model is adjusted by the bytes written (and released by truncate)
+   through mhddfs, so it errs on the side of less free space.
+
+   The dirs sharing a device and the common block sizes are found once
+   at mount.  statfs of the mount is summed up whenever a dir is
+   refreshed, and the bytes accounted since then are taken off the copy
+   when it is read; without the model it reads the dirs every time.
+*/
+
+struct fspace_dir
+{
+	struct statvfs  st;
+	int             valid;
+	time_t          refreshed;
+	long long       drift;
+	long long       adjust;     // bytes, atomic
+};
+
+static struct fspace_dir *dirs = 0;
+static pthread_mutex_t fspace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int refresh_interval = 0;
+static pthread_t thread;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+static int started = 0, stop = 0;  // fspace_lock
+
+static int *same_dev = 0;       // earlier dir on the same device or -1
+static unsigned long min_block = 0, min_frame = 0;
+static struct statvfs total;    // fspace_lock, without the adjusts
+static int total_valid = 0;
+
+static void sum_up(void);
+
+void fspace_refresh(int dir_id)
+{
+	struct fspace_dir *dir;
+	struct statvfs st;
+	long long adjust, model, real;
+
+	if (!dirs || dir_id < 0)
+		return;
+	dir = dirs + dir_id;
+
+	adjust = dir->adjust;
+	if (fstatvfs(mhdd.dir_fds[dir_id], &st) != 0) {
+		mhdd_debug(MHDD_INFO, "fspace_refresh: %s: %s\n",
+			mhdd.dirs[dir_id], strerror(errno));
+		return;
+	}
+
+	pthread_mutex_lock(&fspace_lock);
+	real = (long long)st.f_bsize * st.f_bavail;
+	if (dir->valid) {
+		model = (long long)dir->st.f_bsize * dir->st.f_bavail - adjust;
+		dir->drift = model - real;
+	}
+	dir->st = st;
+	dir->valid = 1;
+	dir->refreshed = time(0);
+	__sync_fetch_and_sub(&dir->adjust, adjust);
+	sum_up();
+	pthread_mutex_unlock(&fspace_lock);
+
+	mhdd_debug(MHDD_DEBUG, "fspace_refresh: %s: free %lld, drift %lld\n",
+		mhdd.dirs[dir_id], real, dir->drift);
+}
+
+// devices of the dirs and the smallest block sizes
+static void topology(void)
+{
+	dev_t *devs = calloc(mhdd.cdirs, sizeof(dev_t));
+	struct statvfs sv;
+	struct stat st;
+	int i, j;
+
+	same_dev = malloc(mhdd.cdirs * sizeof(int));
+	for (i = 0; i < mhdd.cdirs; i++) {
+		same_dev[i] = -1;
+		if (fstat(mhdd.dir_fds[i], &st) == 0)
+			devs[i] = st.st_dev;
+		for (j = 0; devs[i] && j < i; j++)
+			if (devs[j] == devs[i]) {
+				same_dev[i] = j;
+				break;
+			}
+
+		if (fstatvfs(mhdd.dir_fds[i], &sv) != 0)
+			continue;
+		if (!i || sv.f_bsize < min_block)
+			min_block = sv.f_bsize;
+		if (!i || sv.f_frsize < min_frame)
+			min_frame = sv.f_frsize;
+	}
+	if (!min_block)
+		min_block = 512;
+	if (!min_frame)
+		min_frame = 512;
+	free(devs);
+}
+
+// the last snapshot of dir, without the adjust (fspace_lock is held)
+static int dir_statvfs(int dir_id, struct statvfs *buf)
+{
+	if (!dirs || !dirs[dir_id].valid)
+		return fstatvfs(mhdd.dir_fds[dir_id], buf);
+	memcpy(buf, &dirs[dir_id].st, sizeof(struct statvfs));
+	return 0;
+}
+
+// take the bytes accounted since the snapshot off the free blocks
+static void apply_adjust(struct statvfs *buf, long long adjust)
+{
+	fsblkcnt_t blocks;
+
+	if (!buf->f_bsize)
+		return;
+
+	blocks = (adjust > 0 ? adjust : -adjust) / buf->f_bsize;
+	if (adjust > 0) {
+		buf->f_bavail = buf->f_bavail > blocks ?
+			buf->f_bavail - blocks : 0;
+		buf->f_bfree = buf->f_bfree > blocks ?
+			buf->f_bfree - blocks : 0;
+	} else {
+		buf->f_bavail += blocks;
+		buf->f_bfree += blocks;
+	}
+}
+
+// sum of the dirs in the smallest blocks, the devices counted once
+static int sum(struct statvfs *buf)
+{
+	struct statvfs st;
+	int i;
+
+	for (i = 0; i < mhdd.cdirs; i++) {
+		if (dir_statvfs(i, &st) != 0)
+			return -errno;
+
+		if (st.f_bsize && st.f_bsize != min_block) {
+			st.f_bfree = st.f_bfree * st.f_bsize / min_block;
+			st.f_bavail = st.f_bavail * st.f_bsize / min_block;
+			st.f_bsize = min_block;
+		}
+		if (st.f_frsize && st.f_frsize != min_frame) {
+			st.f_blocks = st.f_blocks * st.f_frsize / min_frame;
+			st.f_frsize = min_frame;
+		}
+
+		if (!i) {
+			memcpy(buf, &st, sizeof(struct statvfs));
+			continue;
+		}
+		if (same_dev[i] >= 0)
+			continue;
+
+		if (buf->f_namemax < st.f_namemax)
+			buf->f_namemax = st.f_namemax;
+		buf->f_ffree  += st.f_ffree;
+		buf->f_files  += st.f_files;
+		buf->f_favail += st.f_favail;
+		buf->f_bavail += st.f_bavail;
+		buf->f_bfree  += st.f_bfree;
+		buf->f_blocks += st.f_blocks;
+	}
+	return 0;
+}
+
+// fspace_lock is held
+static void sum_up(void)
+{
+	struct statvfs st;
+
+	if (sum(&st) != 0)
+		return;
+	total = st;
+	total_valid = 1;
+}
+
+static void * fspace_thread(void * arg)
+{
+	struct timespec deadline;
+	int i;
+
+	pthread_mutex_lock(&fspace_lock);
+	while (!stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += refresh_interval;
+		while (!stop && pthread_cond_timedwait(&stop_cond,
+				&fspace_lock, &deadline) != ETIMEDOUT)
+			;
+		if (stop)
+			break;
+		pthread_mutex_unlock(&fspace_lock);
+		for (i = 0; i < mhdd.cdirs; i++)
+			fspace_refresh(i);
+		pthread_mutex_lock(&fspace_lock);
+	}
+	pthread_mutex_unlock(&fspace_lock);
+	return 0;
+}
+
+void fspace_init(int interval)
+{
+	int i;
+
+	topology();
+	if (interval <= 0) {
+		mhdd_debug(MHDD_INFO, "fspace_init: model is off\n");
+		return;
+	}
+
+	refresh_interval = interval;
+	dirs = calloc(mhdd.cdirs, sizeof(struct fspace_dir));
+	for (i = 0; i < mhdd.cdirs; i++)
+		fspace_refresh(i);
+
+	if (pthread_create(&thread, 0, fspace_thread, 0) != 0) {
+		mhdd_debug(MHDD_MSG, "fspace_init: can not start thread: %s\n",
+			strerror(errno));
+		return;
+	}
+	started = 1;
+}
+
+void fspace_stop(void)
+{
+	if (!started)
+		return;
+	pthread_mutex_lock(&fspace_lock);
+	stop = 1;
+	pthread_cond_signal(&stop_cond);
+	pthread_mutex_unlock(&fspace_lock);
+	pthread_join(thread, 0);
+	started = 0;
+}
+
+int fspace_statvfs(int dir_id, struct statvfs *buf)
+{
+	if (!dirs || !dirs[dir_id].valid)
+		return fstatvfs(mhdd.dir_fds[dir_id], buf);
+
+	pthread_mutex_lock(&fspace_lock);
+	dir_statvfs(dir_id, buf);
+	pthread_mutex_unlock(&fspace_lock);
+
+	apply_adjust(buf, dirs[dir_id].adjust);
+	return 0;
+}
+
+int fspace_statfs(struct statvfs *buf)
+{
+	long long adjust = 0;
+	int i;
+
+	if (!total_valid)
+		return sum(buf);
+
+	pthread_mutex_lock(&fspace_lock);
+	memcpy(buf, &total, sizeof(struct statvfs));
+	/* all dirs: the ones sharing a device share its free space */
+	for (i = 0; i < mhdd.cdirs; i++)
+		adjust += dirs[i].adjust;
+	pthread_mutex_unlock(&fspace_lock);
+
+	apply_adjust(buf, adjust);
+	return 0;
+}
+
+void fspace_used(int dir_id, long long bytes)
+{
+	if (!dirs || dir_id < 0)
+		return;
+	__sync_fetch_and_add(&dirs[dir_id].adjust, bytes);
+}
+
+void fspace_get_info(int dir_id, struct fspace_info *info)
+{
+	memset(info, 0, sizeof(struct fspace_info));
+	if (!dirs)
+		return;
+
+	pthread_mutex_lock(&fspace_lock);
+	info->age = time(0) - dirs[dir_id].refreshed;
+	info->drift = dirs[dir_id].drift;
+	info->adjust = dirs[dir_id].adjust;
+	pthread_mutex_unlock(&fspace_lock);
+}
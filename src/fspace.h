@@ -0,0 +1,55 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FSPACE__H__
+#define __FSPACE__H__
+
+#include <time.h>
+#include <sys/statvfs.h>
+
+// free space model of the dirs, refreshed in background
+
+#define FSPACE_DEFAULT_INTERVAL 0
+
+struct fspace_info
+{
+	time_t      age;        // seconds since the last statvfs
+	long long   drift;      // model - real free bytes at last refresh
+	long long   adjust;     // bytes accounted since last refresh
+};
+
+// read all dirs and start refresh thread
+void fspace_init(int interval);
+
+// stop the refresh thread
+void fspace_stop(void);
+
+// statvfs of dir from the model (or real one if the model is off)
+int fspace_statvfs(int dir_id, struct statvfs *buf);
+
+// bytes allocated (> 0) or released (< 0) on dir
+void fspace_used(int dir_id, long long bytes);
+
+// reread dir now
+void fspace_refresh(int dir_id);
+
+// statvfs of the whole mount (the dirs summed up)
+int fspace_statfs(struct statvfs *buf);
+
+void fspace_get_info(int dir_id, struct fspace_info *info);
+
+#endif
@@ -0,0 +1,988 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fuse_lowlevel.h>
+
+#include "lowlevel.h"
+#include "tools.h"
+#include "flist.h"
+#include "debug.h"
+#include "parse_options.h"
+#include "stats.h"
+#include "watch.h"
+
+#include <uthash.h>
+
+/*
+   The kernel talks to us by inode numbers.  Every inode it knows is a
+   node with its path in the mhddfs tree and the dir it was last found
+   in, so lookup, getattr and open of a known node go straight to that
+   dir instead of resolving the path again.  The rest of the requests
+   are served by the path handlers of main.c.
+*/
+
+#define LL_TIMEOUT 1.0
+#define LL_UNKNOWN_INO 0xffffffff   // as the high-level readdir of libfuse
+
+struct ll_node
+{
+	fuse_ino_t      ino;
+	char            *path;
+	int             dir_id;     // -1 if unknown
+	unsigned long   nlookup;
+	int             hashed;     // reachable by path
+	UT_hash_handle  hh;         // by ino
+	UT_hash_handle  hp;         // by path
+};
+
+// opened directory: the whole listing in fuse_add_direntry format
+struct ll_dir
+{
+	char            *buf;
+	size_t          size;
+	fuse_req_t      req;
+	const char      *path;      // while it is listed
+};
+
+static struct ll_node *nodes = 0;
+static struct ll_node *paths = 0;
+static fuse_ino_t last_ino = FUSE_ROOT_ID;
+static pthread_rwlock_t nodes_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct fuse_operations *oper = 0;
+static struct fuse_chan *ll_chan = 0;      // for the notifications, atomic
+
+// handlers of opened files use the path for logging only
+static const char ll_fh_path[] = "(fh)";
+
+static struct ll_node * node_new(fuse_ino_t ino, const char *path)
+{
+	struct ll_node *node = calloc(1, sizeof(struct ll_node));
+	node->ino = ino;
+	node->path = strdup(path);
+	node->dir_id = -1;
+	node->hashed = 1;
+	HASH_ADD(hh, nodes, ino, sizeof(fuse_ino_t), node);
+	HASH_ADD_KEYPTR(hp, paths, node->path, strlen(node->path), node);
+	return node;
+}
+
+static void node_unhash(struct ll_node *node)
+{
+	if (!node->hashed)
+		return;
+	HASH_DELETE(hp, paths, node);
+	node->hashed = 0;
+}
+
+static void node_free(struct ll_node *node)
+{
+	node_unhash(node);
+	HASH_DELETE(hh, nodes, node);
+	free(node->path);
+	free(node);
+}
+
+// malloced path of the node or 0
+static char * node_path(fuse_ino_t ino, int *dir_id)
+{
+	struct ll_node *node;
+	char *path = 0;
+
+	pthread_rwlock_rdlock(&nodes_lock);
+	HASH_FIND(hh, nodes, &ino, sizeof(fuse_ino_t), node);
+	if (node) {
+		path = strdup(node->path);
+		if (dir_id)
+			*dir_id = node->dir_id;
+	}
+	pthread_rwlock_unlock(&nodes_lock);
+	return path;
+}
+
+// malloced path of name in the node parent or 0
+static char * child_path(fuse_ino_t parent, const char *name)
+{
+	struct ll_node *node;
+	char *path = 0;
+
+	pthread_rwlock_rdlock(&nodes_lock);
+	HASH_FIND(hh, nodes, &parent, sizeof(fuse_ino_t), node);
+	if (node)
+		path = create_path(node->path, name);
+	pthread_rwlock_unlock(&nodes_lock);
+	return path;
+}
+
+static void node_set_dir(fuse_ino_t ino, int dir_id)
+{
+	struct ll_node *node;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hh, nodes, &ino, sizeof(fuse_ino_t), node);
+	if (node)
+		node->dir_id = dir_id;
+	pthread_rwlock_unlock(&nodes_lock);
+}
+
+// path was removed, the next lookup gets a new node
+static void node_drop(const char *path)
+{
+	struct ll_node *node;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (node)
+		node_unhash(node);
+	pthread_rwlock_unlock(&nodes_lock);
+}
+
+// path was renamed: rename the node and all the nodes below it
+static void node_move(const char *from, const char *to)
+{
+	struct ll_node *node, *tmp, *moved = 0;
+	size_t flen = strlen(from);
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hp, paths, to, strlen(to), node);
+	if (node)
+		node_unhash(node);
+
+	HASH_ITER(hp, paths, node, tmp) {
+		if (strncmp(node->path, from, flen) != 0)
+			continue;
+		if (node->path[flen] != 0 && node->path[flen] != '/')
+			continue;
+
+		char *path = malloc(strlen(to) + strlen(node->path + flen) + 1);
+		sprintf(path, "%s%s", to, node->path + flen);
+		HASH_DELETE(hp, paths, node);
+		free(node->path);
+		node->path = path;
+		HASH_ADD_KEYPTR(hp, moved, node->path,
+			strlen(node->path), node);
+	}
+
+	HASH_ITER(hp, moved, node, tmp) {
+		HASH_DELETE(hp, moved, node);
+		HASH_ADD_KEYPTR(hp, paths, node->path,
+			strlen(node->path), node);
+	}
+	pthread_rwlock_unlock(&nodes_lock);
+}
+
+// lstat path, dir_id is a hint and gets the dir the path was found in
+static int ll_stat(const char *path, int *dir_id, struct stat *st)
+{
+	if (stats_is_path(path))
+		return stats_getattr(path, st);
+
+	if (*dir_id >= 0 && *dir_id < mhdd.cdirs) {
+		stats_dir(*dir_id, STATS_SYSCALLS, 1);
+		if (fstatat(mhdd.dir_fds[*dir_id], rel_path(path), st,
+				AT_SYMLINK_NOFOLLOW) == 0)
+			return 0;
+	}
+
+	if ((*dir_id = find_path_stat(path, st)) == -1)
+		return -ENOENT;
+	return 0;
+}
+
+// find or create the node of path, count the kernel reference
+static int node_lookup(const char *path, struct fuse_entry_param *e)
+{
+	struct ll_node *node;
+	int dir_id = -1, res;
+
+	pthread_rwlock_rdlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (node)
+		dir_id = node->dir_id;
+	pthread_rwlock_unlock(&nodes_lock);
+
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	if ((res = ll_stat(path, &dir_id, &e->attr)) != 0)
+		return res;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (!node)
+		node = node_new(++last_ino, path);
+	node->dir_id = dir_id;
+	node->nlookup++;
+	e->ino = node->ino;
+	pthread_rwlock_unlock(&nodes_lock);
+
+	e->attr.st_ino = e->ino;
+	e->attr_timeout = LL_TIMEOUT;
+	e->entry_timeout = LL_TIMEOUT;
+	return 0;
+}
+
+void lowlevel_moved(const char *path, int dir_id)
+{
+	struct ll_node *node;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (node)
+		node->dir_id = dir_id;
+	pthread_rwlock_unlock(&nodes_lock);
+}
+
+void lowlevel_invalidate(const char *path, int entry)
+{
+	struct ll_node *node;
+	fuse_ino_t ino = 0, parent = 0;
+	char parent_path[PATH_MAX];
+
+	struct fuse_chan *ch = __atomic_load_n(&ll_chan, __ATOMIC_ACQUIRE);
+
+	if (!ch)
+		return;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (node) {
+		ino = node->ino;
+		node->dir_id = -1;
+	}
+	if (entry && path_parent(parent_path, path)) {
+		HASH_FIND(hp, paths, parent_path, strlen(parent_path), node);
+		if (node)
+			parent = node->ino;
+	}
+	pthread_rwlock_unlock(&nodes_lock);
+
+#if FUSE_VERSION >= 28
+	char name[PATH_MAX];
+
+	/* the kernel may send forgets meanwhile, no lock is held */
+	if (ino)
+		fuse_lowlevel_notify_inval_inode(ch, ino, 0, 0);
+	if (parent && path_base(name, path))
+		fuse_lowlevel_notify_inval_entry(ch, parent,
+			name, strlen(name));
+#endif
+}
+
+static void ll_caller(fuse_req_t req)
+{
+	const struct fuse_ctx *ctx = fuse_req_ctx(req);
+	set_caller(ctx->uid, ctx->gid);
+}
+
+// reply the entry made by a path handler
+static void ll_reply_entry(fuse_req_t req, const char *path, int res)
+{
+	struct fuse_entry_param e;
+
+	if (res == 0)
+		res = node_lookup(path, &e);
+	if (res == 0)
+		fuse_reply_entry(req, &e);
+	else
+		fuse_reply_err(req, -res);
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	if (oper->init)
+		oper->init(conn);
+}
+
+static void ll_destroy(void *userdata)
+{
+	if (oper->destroy)
+		oper->destroy(0);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct fuse_entry_param e;
+	uint64_t start = stats_now();
+	int res;
+	char *path = child_path(parent, name);
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	mhdd_debug(MHDD_DEBUG, "ll_lookup: %s\n", path);
+	res = node_lookup(path, &e);
+	stats_op(STATS_GETATTR, start, res);
+	free(path);
+	if (res == 0)
+		fuse_reply_entry(req, &e);
+	else
+		fuse_reply_err(req, -res);
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	struct ll_node *node;
+
+	pthread_rwlock_wrlock(&nodes_lock);
+	HASH_FIND(hh, nodes, &ino, sizeof(fuse_ino_t), node);
+	if (node && ino != FUSE_ROOT_ID) {
+		if (node->nlookup <= nlookup)
+			node_free(node);
+		else
+			node->nlookup -= nlookup;
+	}
+	pthread_rwlock_unlock(&nodes_lock);
+	fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	struct stat st;
+	int dir_id, found, res;
+	uint64_t start = stats_now();
+	char *path = node_path(ino, &dir_id);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	found = dir_id;
+	res = ll_stat(path, &found, &st);
+	stats_op(STATS_GETATTR, start, res);
+	free(path);
+	if (res != 0) {
+		fuse_reply_err(req, -res);
+		return;
+	}
+	if (found != dir_id)
+		node_set_dir(ino, found);
+	st.st_ino = ino;
+	fuse_reply_attr(req, &st, LL_TIMEOUT);
+}
+
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+		int to_set, struct fuse_file_info *fi)
+{
+	struct stat st;
+	int dir_id, res = 0;
+	char *path = node_path(ino, &dir_id);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	if (to_set & FUSE_SET_ATTR_MODE)
+		res = oper->chmod(path, attr->st_mode);
+
+	if (!res && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+		res = oper->chown(path,
+			(to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : -1,
+			(to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : -1);
+
+	if (!res && (to_set & FUSE_SET_ATTR_SIZE)) {
+		if (fi)
+			res = oper->ftruncate(ll_fh_path, attr->st_size, fi);
+		else
+			res = oper->truncate(path, attr->st_size);
+	}
+
+	if (!res && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+		struct timespec ts[2];
+		struct timeval now;
+
+		res = ll_stat(path, &dir_id, &st);
+		if (!res) {
+			gettimeofday(&now, 0);
+			ts[0] = st.st_atim;
+			ts[1] = st.st_mtim;
+			if (to_set & FUSE_SET_ATTR_ATIME)
+				ts[0] = attr->st_atim;
+			if (to_set & FUSE_SET_ATTR_MTIME)
+				ts[1] = attr->st_mtim;
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+			if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+				ts[0].tv_sec = now.tv_sec;
+				ts[0].tv_nsec = now.tv_usec * 1000;
+			}
+			if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+				ts[1].tv_sec = now.tv_sec;
+				ts[1].tv_nsec = now.tv_usec * 1000;
+			}
+#endif
+			res = oper->utimens(path, ts);
+		}
+	}
+
+	if (!res)
+		res = ll_stat(path, &dir_id, &st);
+	free(path);
+
+	if (res) {
+		fuse_reply_err(req, -res);
+		return;
+	}
+	st.st_ino = ino;
+	fuse_reply_attr(req, &st, LL_TIMEOUT);
+}
+
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+	char buf[PATH_MAX + 1];
+	int res;
+	char *path = node_path(ino, 0);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	res = oper->readlink(path, buf, PATH_MAX);
+	free(path);
+	buf[PATH_MAX] = 0;
+	if (res == 0)
+		fuse_reply_readlink(req, buf);
+	else
+		fuse_reply_err(req, -res);
+}
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+		mode_t mode, dev_t rdev)
+{
+	char *path = child_path(parent, name);
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	ll_caller(req);
+	ll_reply_entry(req, path, oper->mknod(path, mode, rdev));
+	free(path);
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+		mode_t mode)
+{
+	char *path = child_path(parent, name);
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	ll_caller(req);
+	ll_reply_entry(req, path, oper->mkdir(path, mode));
+	free(path);
+}
+
+static void ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
+		const char *name)
+{
+	char *path = child_path(parent, name);
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	ll_caller(req);
+	ll_reply_entry(req, path, oper->symlink(link, path));
+	free(path);
+}
+
+static void ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+		const char *newname)
+{
+	char *from = node_path(ino, 0);
+	char *to = child_path(newparent, newname);
+
+	if (from && to) {
+		ll_caller(req);
+		ll_reply_entry(req, to, oper->link(from, to));
+	} else
+		fuse_reply_err(req, ENOENT);
+	free(from);
+	free(to);
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	int res = -ENOENT;
+	char *path = child_path(parent, name);
+
+	if (path) {
+		res = oper->unlink(path);
+		if (res == 0)
+			node_drop(path);
+		free(path);
+	}
+	fuse_reply_err(req, -res);
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	int res = -ENOENT;
+	char *path = child_path(parent, name);
+
+	if (path) {
+		res = oper->rmdir(path);
+		if (res == 0)
+			node_drop(path);
+		free(path);
+	}
+	fuse_reply_err(req, -res);
+}
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+		fuse_ino_t newparent, const char *newname)
+{
+	int res = -ENOENT;
+	char *from = child_path(parent, name);
+	char *to = child_path(newparent, newname);
+
+	if (from && to) {
+		res = oper->rename(from, to);
+		if (res == 0)
+			node_move(from, to);
+	}
+	free(from);
+	free(to);
+	fuse_reply_err(req, -res);
+}
+
+// open in the dir the node was found in, path handler if it is gone
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int dir_id, fd, res;
+	uint64_t start = stats_now();
+	char *path = node_path(ino, &dir_id);
+	char real[PATH_MAX];
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	if (dir_id >= 0 && dir_id < mhdd.cdirs &&
+			dir_path(real, dir_id, path)) {
+		fd = openat(mhdd.dir_fds[dir_id], rel_path(path), fi->flags);
+		stats_dir(dir_id, STATS_SYSCALLS, 1);
+		if (fd != -1) {
+			struct flist *add = flist_create(path, real,
+				fi->flags, fd);
+			add->dir_id = dir_id;
+			fi->fh = add->id;
+			fi->keep_cache = mhdd.keep_cache;
+			flist_unlock();
+			free(path);
+			stats_op(STATS_OPEN, start, 0);
+			fuse_reply_open(req, fi);
+			return;
+		}
+		res = -errno;
+		if (res != -ENOENT) {
+			stats_op(STATS_OPEN, start, res);
+			free(path);
+			fuse_reply_err(req, -res);
+			return;
+		}
+	}
+
+	ll_caller(req);
+	res = oper->open(path, fi);
+	free(path);
+	if (res == 0)
+		fuse_reply_open(req, fi);
+	else
+		fuse_reply_err(req, -res);
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+		mode_t mode, struct fuse_file_info *fi)
+{
+	struct fuse_entry_param e;
+	int res;
+	char *path = child_path(parent, name);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	ll_caller(req);
+	res = oper->create(path, mode, fi);
+	if (res == 0) {
+		res = node_lookup(path, &e);
+		if (res == 0)
+			fuse_reply_create(req, &e, fi);
+		else
+			oper->release(ll_fh_path, fi);
+	}
+	free(path);
+	if (res != 0)
+		fuse_reply_err(req, -res);
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		struct fuse_file_info *fi)
+{
+	char *buf = malloc(size);
+	int res;
+
+	if (!buf) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	res = oper->read(ll_fh_path, buf, size, off, fi);
+	if (res >= 0)
+		fuse_reply_buf(req, buf, res);
+	else
+		fuse_reply_err(req, -res);
+	free(buf);
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+		size_t size, off_t off, struct fuse_file_info *fi)
+{
+	int res = oper->write(ll_fh_path, buf, size, off, fi);
+	if (res >= 0)
+		fuse_reply_write(req, res);
+	else
+		fuse_reply_err(req, -res);
+}
+
+#if FUSE_VERSION >= 29
+static void ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode,
+		off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, -oper->fallocate(ll_fh_path, mode, offset,
+		length, fi));
+}
+#endif
+
+static void ll_flush(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, 0);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	oper->release(ll_fh_path, fi);
+	fuse_reply_err(req, 0);
+}
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+		struct fuse_file_info *fi)
+{
+	fuse_reply_err(req, -oper->fsync(ll_fh_path, datasync, fi));
+}
+
+// the inode lookup gives for name, unknown if the kernel has not got it
+static fuse_ino_t ll_entry_ino(struct ll_dir *dir, const char *name)
+{
+	struct ll_node *node;
+	fuse_ino_t ino = LL_UNKNOWN_INO;
+	char buf[PATH_MAX];
+	const char *path = buf;
+
+	if (strcmp(name, ".") == 0)
+		path = dir->path;
+	else if (strcmp(name, "..") == 0) {
+		if (!path_parent(buf, dir->path))
+			return ino;
+	} else if (!path_join(buf, dir->path, name))
+		return ino;
+
+	pthread_rwlock_rdlock(&nodes_lock);
+	HASH_FIND(hp, paths, path, strlen(path), node);
+	if (node)
+		ino = node->ino;
+	pthread_rwlock_unlock(&nodes_lock);
+	return ino;
+}
+
+static int ll_filler(void *buf, const char *name,
+		const struct stat *st, off_t off)
+{
+	struct ll_dir *dir = buf;
+	size_t old = dir->size;
+	size_t len = fuse_add_direntry(dir->req, 0, 0, name, 0, 0);
+	char *p = realloc(dir->buf, old + len);
+	struct stat ent;
+
+	/* as the high-level filler: no attributes is an unknown type */
+	memset(&ent, 0, sizeof(ent));
+	if (st)
+		ent.st_mode = st->st_mode;
+	/* d_ino agrees with lookup and getattr, not the dir's inode */
+	ent.st_ino = ll_entry_ino(dir, name);
+
+	if (!p)
+		return 1;
+	dir->buf = p;
+	dir->size = old + len;
+	fuse_add_direntry(dir->req, dir->buf + old, len, name, &ent,
+		dir->size);
+	return 0;
+}
+
+// the listing is merged once on open and then served by offsets
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	struct ll_dir *dir;
+	int res;
+	char *path = node_path(ino, 0);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	dir = calloc(1, sizeof(struct ll_dir));
+	dir->req = req;
+	dir->path = path;
+	res = oper->readdir(path, dir, ll_filler, 0, fi);
+	dir->path = 0;
+	free(path);
+	if (res != 0) {
+		free(dir->buf);
+		free(dir);
+		fuse_reply_err(req, -res);
+		return;
+	}
+	fi->fh = (uintptr_t)dir;
+	fuse_reply_open(req, fi);
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+		off_t off, struct fuse_file_info *fi)
+{
+	struct ll_dir *dir = (struct ll_dir *)(uintptr_t)fi->fh;
+
+	if (off >= dir->size) {
+		fuse_reply_buf(req, 0, 0);
+		return;
+	}
+	if (size > dir->size - off)
+		size = dir->size - off;
+	fuse_reply_buf(req, dir->buf + off, size);
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+		struct fuse_file_info *fi)
+{
+	struct ll_dir *dir = (struct ll_dir *)(uintptr_t)fi->fh;
+	free(dir->buf);
+	free(dir);
+	fuse_reply_err(req, 0);
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs st;
+	int res = oper->statfs("/", &st);
+	if (res == 0)
+		fuse_reply_statfs(req, &st);
+	else
+		fuse_reply_err(req, -res);
+}
+
+static void ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+	int res = -ENOENT;
+	char *path = node_path(ino, 0);
+
+	if (path) {
+		res = oper->access(path, mask);
+		free(path);
+	}
+	fuse_reply_err(req, -res);
+}
+
+#ifndef WITHOUT_XATTR
+static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+		const char *value, size_t size, int flags)
+{
+	int res = -ENOENT;
+	char *path = node_path(ino, 0);
+
+	if (path) {
+		res = oper->setxattr(path, name, value, size, flags);
+		free(path);
+	}
+	fuse_reply_err(req, -res);
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+		size_t size)
+{
+	char *buf = 0;
+	int res;
+	char *path = node_path(ino, 0);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	if (size)
+		buf = malloc(size);
+	res = oper->getxattr(path, name, buf, size);
+	free(path);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else if (!size)
+		fuse_reply_xattr(req, res);
+	else
+		fuse_reply_buf(req, buf, res);
+	free(buf);
+}
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	char *buf = 0;
+	int res;
+	char *path = node_path(ino, 0);
+
+	if (!path) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	if (size)
+		buf = malloc(size);
+	res = oper->listxattr(path, buf, size);
+	free(path);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else if (!size)
+		fuse_reply_xattr(req, res);
+	else
+		fuse_reply_buf(req, buf, res);
+	free(buf);
+}
+
+static void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+	int res = -ENOENT;
+	char *path = node_path(ino, 0);
+
+	if (path) {
+		res = oper->removexattr(path, name);
+		free(path);
+	}
+	fuse_reply_err(req, -res);
+}
+#endif
+
+static struct fuse_lowlevel_ops ll_oper = {
+	.init		= ll_init,
+	.destroy	= ll_destroy,
+	.lookup		= ll_lookup,
+	.forget		= ll_forget,
+	.getattr	= ll_getattr,
+	.setattr	= ll_setattr,
+	.readlink	= ll_readlink,
+	.mknod		= ll_mknod,
+	.mkdir		= ll_mkdir,
+	.symlink	= ll_symlink,
+	.link		= ll_link,
+	.unlink		= ll_unlink,
+	.rmdir		= ll_rmdir,
+	.rename		= ll_rename,
+	.open		= ll_open,
+	.create		= ll_create,
+	.read		= ll_read,
+	.write		= ll_write,
+	.flush		= ll_flush,
+	.release	= ll_release,
+	.fsync		= ll_fsync,
+#if FUSE_VERSION >= 29
+	.fallocate	= ll_fallocate,
+#endif
+	.opendir	= ll_opendir,
+	.readdir	= ll_readdir,
+	.releasedir	= ll_releasedir,
+	.statfs		= ll_statfs,
+	.access		= ll_access,
+#ifndef WITHOUT_XATTR
+	.setxattr	= ll_setxattr,
+	.getxattr	= ll_getxattr,
+	.listxattr	= ll_listxattr,
+	.removexattr	= ll_removexattr,
+#endif
+};
+
+// the page cache options are done by ll_open (keep_cache)
+static const struct fuse_opt ll_cache_opts[] = {
+	FUSE_OPT_KEY("kernel_cache", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_KEY("auto_cache", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_END
+};
+
+int lowlevel_main(struct fuse_args *args, struct fuse_operations *op)
+{
+	struct fuse_session *se;
+	struct fuse_chan *ch;
+	char *mountpoint;
+	int multithreaded, foreground, res = -1;
+
+	oper = op;
+	struct ll_node *root = node_new(FUSE_ROOT_ID, "/");
+	root->dir_id = 0;
+	root->nlookup = 1;
+
+	if (fuse_opt_parse(args, 0, ll_cache_opts, 0) == -1 ||
+			fuse_parse_cmdline(args, &mountpoint,
+			&multithreaded, &foreground) == -1)
+		return 1;
+
+	ch = fuse_mount(mountpoint, args);
+	if (!ch) {
+		free(mountpoint);
+		return 1;
+	}
+
+	se = fuse_lowlevel_new(args, &ll_oper, sizeof(ll_oper), 0);
+	if (se) {
+		if (fuse_set_signal_handlers(se) != -1) {
+			fuse_session_add_chan(se, ch);
+			__atomic_store_n(&ll_chan, ch, __ATOMIC_RELEASE);
+			if (fuse_daemonize(foreground) != -1)
+				res = multithreaded ?
+					fuse_session_loop_mt(se) :
+					fuse_session_loop(se);
+			/* destroy comes after the chan is removed */
+			watch_stop();
+			__atomic_store_n(&ll_chan, 0, __ATOMIC_RELEASE);
+			fuse_remove_signal_handlers(se);
+			fuse_session_remove_chan(ch);
+		}
+		fuse_session_destroy(se);
+	}
+	fuse_unmount(mountpoint, ch);
+	free(mountpoint);
+	fuse_opt_free_args(args);
+	return res ? 1 : 0;
+}
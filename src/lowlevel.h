@@ -0,0 +1,34 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LOWLEVEL__H__
+#define __LOWLEVEL__H__
+
+#include <fuse.h>
+
+// inode based backend (-o lowlevel)
+// keeps a node table and calls the path handlers of oper
+int lowlevel_main(struct fuse_args *args, struct fuse_operations *oper);
+
+// file was moved to dir_id (its opened handles were reopened there)
+void lowlevel_moved(const char *path, int dir_id);
+
+// path was changed behind mhddfs: forget its dir and tell the kernel
+// (entry - the name in the parent too)
+void lowlevel_invalidate(const char *path, int entry);
+
+#endif
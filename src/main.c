@@ -26,11 +26,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <utime.h>
+#include <sys/syscall.h>
+#ifdef __NR_fallocate
+#include <linux/falloc.h>
+#endif
 
 #ifndef WITHOUT_XATTR
 #include <attr/xattr.h>
@@ -38,6 +44,17 @@
 
 #include "parse_options.h"
 #include "tools.h"
+#include "pcache.h"
+#include "mover.h"
+#include "fspace.h"
+#include "lowlevel.h"
+#include "tpool.h"
+#include "uring.h"
+#include "stats.h"
+#include "policy.h"
+#include "pindex.h"
+#include "warmup.h"
+#include "watch.h"
 
 #include "debug.h"
 
@@ -47,13 +64,10 @@
 static int mhdd_stat(const char *file_name, struct stat *buf)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_stat: %s\n", file_name);
-	char *path = find_path(file_name);
-	if (path) {
-		int ret = lstat(path, buf);
-		free(path);
-		if (ret == -1) return -errno;
+	if (stats_is_path(file_name))
+		return stats_getattr(file_name, buf);
+	if (find_path_stat(file_name, buf) != -1)
 		return 0;
-	}
 	errno = ENOENT;
 	return -errno;
 }
@@ -61,91 +75,78 @@ static int mhdd_stat(const char *file_name, struct stat *buf)
 //statvfs
 static int mhdd_statfs(const char *path, struct statvfs *buf)
 {
-	int i, j;
-	struct statvfs * stats;
-	struct stat st;
-	dev_t * devices;
-
 	mhdd_debug(MHDD_MSG, "mhdd_statfs: %s\n", path);
+	return fspace_statfs(buf);
+}
 
-	stats = calloc(mhdd.cdirs, sizeof(struct statvfs));
-	devices = calloc(mhdd.cdirs, sizeof(dev_t));
+// one dir of the listing
+struct readdir_dir
+{
+	int             found;      // path exists
+	int             isdir;
+	int             count;
+	char            **names;
+	struct dirent   *ents;      // d_ino and d_type of the names
+	DIR             *dh;        // open until the listing is filled
+};
 
-	for (i = 0; i < mhdd.cdirs; i++) {
-		int ret = statvfs(mhdd.dirs[i], stats+i);
-		if (ret != 0) {
-			free(stats);
-			free(devices);
-			return -errno;
-		}
+struct readdir_scan
+{
+	const char          *dirname;
+	struct readdir_dir  dirs[];
+};
 
-		ret = stat(mhdd.dirs[i], &st);
-		if (ret != 0) {
-			free(stats);
-			free(devices);
-			return -errno;
-		}
-		devices[i] = st.st_dev;
+// read the names of dir i, the attributes come from the dirents
+static void readdir_scan_dir(void *data, int i)
+{
+	struct readdir_scan *scan = data;
+	struct readdir_dir *rd = scan->dirs + i;
+	struct dirent *de;
+	DIR *dh;
+	int fd, size = 0;
+
+	fd = openat(mhdd.dir_fds[i], rel_path(scan->dirname),
+		O_RDONLY | O_DIRECTORY);
+	stats_dir(i, STATS_SYSCALLS, 1);
+	if (fd == -1) {
+		rd->found = errno == ENOTDIR;
+		return;
 	}
+	rd->found = rd->isdir = 1;
 
-	unsigned long
-		min_block = stats[0].f_bsize,
-		min_frame = stats[0].f_frsize;
-
-	for (i = 1; i<mhdd.cdirs; i++) {
-		if (min_block>stats[i].f_bsize) min_block = stats[i].f_bsize;
-		if (min_frame>stats[i].f_frsize) min_frame = stats[i].f_frsize;
+	if (!(dh = fdopendir(fd))) {
+		close(fd);
+		return;
 	}
 
-	if (!min_block)
-		min_block = 512;
-	if (!min_frame)
-		min_frame = 512;
-
-	for (i = 0; i < mhdd.cdirs; i++) {
-		if (stats[i].f_bsize>min_block) {
-			stats[i].f_bfree    *=  stats[i].f_bsize/min_block;
-			stats[i].f_bavail   *=  stats[i].f_bsize/min_block;
-			stats[i].f_bsize    =   min_block;
-		}
-		if (stats[i].f_frsize>min_frame) {
-			stats[i].f_blocks   *=  stats[i].f_frsize/min_frame;
-			stats[i].f_frsize   =   min_frame;
+	while((de = readdir(dh))) {
+		if (rd->count == size) {
+			size = size ? size * 2 : 64;
+			rd->names = realloc(rd->names, size * sizeof(char *));
+			rd->ents = realloc(rd->ents,
+				size * sizeof(struct dirent));
 		}
+		rd->ents[rd->count].d_ino = de->d_ino;
+		rd->ents[rd->count].d_type = de->d_type;
+		rd->names[rd->count++] = strdup(de->d_name);
 	}
+	rd->dh = dh;
+	stats_dir(i, STATS_SYSCALLS, 1);
+}
 
-	memcpy(buf, stats, sizeof(struct statvfs));
-
-	for (i = 1; i<mhdd.cdirs; i++) {
-
-		/* if the device already processed, skip it */
-		if (devices[i]) {
-			int dup_found = 0;
-			for (j = 0; j < i; j++) {
-				if (devices[j] == devices[i]) {
-					dup_found = 1;
-					break;
-				}
-			}
-
-			if (dup_found)
-				continue;
-		}
-
-		if (buf->f_namemax<stats[i].f_namemax) {
-			buf->f_namemax = stats[i].f_namemax;
-		}
-		buf->f_ffree  +=  stats[i].f_ffree;
-		buf->f_files  +=  stats[i].f_files;
-		buf->f_favail +=  stats[i].f_favail;
-		buf->f_bavail +=  stats[i].f_bavail;
-		buf->f_bfree  +=  stats[i].f_bfree;
-		buf->f_blocks +=  stats[i].f_blocks;
+// attributes of an entry that won the merge: only the filesystems
+// without d_type cost a stat
+static void readdir_stat(struct readdir_dir *rd, int i, int j,
+		struct stat *st)
+{
+	memset(st, 0, sizeof(struct stat));
+	st->st_ino = rd->ents[j].d_ino;
+	if (rd->ents[j].d_type != DT_UNKNOWN) {
+		st->st_mode = DTTOIF(rd->ents[j].d_type);
+		return;
 	}
-
-	free(stats);
-	free(devices);
-	return 0;
+	fstatat(dirfd(rd->dh), rd->names[j], st, AT_SYMLINK_NOFOLLOW);
+	stats_dir(i, STATS_SYSCALLS, 1);
 }
 
 static int mhdd_readdir(
@@ -155,70 +156,60 @@ static int mhdd_readdir(
 		off_t offset,
 		struct fuse_file_info * fi)
 {
-	int i, j, found;
+	int i, j, found, isdir;
 
 	mhdd_debug(MHDD_MSG, "mhdd_readdir: %s\n", dirname);
-	char **dirs = (char **) calloc(mhdd.cdirs+1, sizeof(char *));
+	if (stats_is_path(dirname))
+		return stats_readdir(dirname, buf, filler);
 
 	typedef struct dir_item {
 		char            *name;
-		struct stat     *st;
+		int             dir, entry;
 		UT_hash_handle   hh;
 	} dir_item;
 
 	dir_item * items_ht = NULL;
 
-
-	struct stat st;
-
-	// find all dirs
-	for(i = j = found = 0; i<mhdd.cdirs; i++) {
-		char *path = create_path(mhdd.dirs[i], dirname);
-		if (stat(path, &st) == 0) {
-			found++;
-			if (S_ISDIR(st.st_mode)) {
-				dirs[j] = path;
-				j++;
-				continue;
-			}
-		}
-		free(path);
+	// read all dirs at once
+	struct readdir_scan *scan = calloc(1, sizeof(struct readdir_scan) +
+		mhdd.cdirs * sizeof(struct readdir_dir));
+	scan->dirname = dirname;
+	struct tpool_batch *batch =
+		tpool_start(readdir_scan_dir, scan, mhdd.cdirs);
+	tpool_wait(batch, -1);
+
+	for (i = found = isdir = 0; i < mhdd.cdirs; i++) {
+		found += scan->dirs[i].found;
+		isdir += scan->dirs[i].isdir;
 	}
 
 	// dirs not found
-	if (dirs[0] == 0) {
+	if (!isdir) {
 		errno = ENOENT;
 		if (found) errno = ENOTDIR;
-		free(dirs);
+		tpool_free(batch);
 		return -errno;
 	}
 
-	// read directories
-	for (i = 0; dirs[i]; i++) {
-		struct dirent *de;
-		DIR * dh = opendir(dirs[i]);
-		if (!dh)
-			continue;
-
-		while((de = readdir(dh))) {
-			// find dups
-			
+	// merge, the first dir wins
+	for (i = 0; i < mhdd.cdirs; i++) {
+		struct readdir_dir *rd = scan->dirs + i;
+		for (j = 0; j < rd->count; j++) {
 			struct dir_item *prev;
 
-			HASH_FIND_STR(items_ht, de->d_name, prev);
+			HASH_FIND_STR(items_ht, rd->names[j], prev);
 
 			if (prev) {
 				continue;
 			}
 
 			// add item
-			char *object_name = create_path(dirs[i], de->d_name);
 			struct dir_item *new_item =
 				calloc(1, sizeof(struct dir_item));
 
-			new_item->name = strdup(de->d_name);
-			new_item->st = calloc(1, sizeof(struct stat));
-			lstat(object_name, new_item->st);
+			new_item->name = rd->names[j];
+			new_item->dir = i;
+			new_item->entry = j;
 
 			HASH_ADD_KEYPTR(
 				hh,
@@ -227,31 +218,36 @@ static int mhdd_readdir(
 				strlen(new_item->name),
 				new_item
 			);
-			free(object_name);
 		}
-
-		closedir(dh);
 	}
 
 	dir_item *item, *tmp;
+	struct stat st;
 
 	// fill list
 	HASH_ITER(hh, items_ht, item, tmp) {
-		if (filler(buf, item->name, item->st, 0))
+		readdir_stat(scan->dirs + item->dir, item->dir, item->entry,
+			&st);
+		if (filler(buf, item->name, &st, 0))
 			break;
 	}
 
 	// free memory
 	HASH_ITER(hh, items_ht, item, tmp) {
-		free(item->name);
-		free(item->st);
+		HASH_DEL(items_ht, item);
 		free(item);
 	}
-	HASH_CLEAR(hh, items_ht);
 
-	for (i = 0; dirs[i]; i++)
-		free(dirs[i]);
-	free(dirs);
+	for (i = 0; i < mhdd.cdirs; i++) {
+		struct readdir_dir *rd = scan->dirs + i;
+		for (j = 0; j < rd->count; j++)
+			free(rd->names[j]);
+		free(rd->names);
+		free(rd->ents);
+		if (rd->dh)
+			closedir(rd->dh);
+	}
+	tpool_free(batch);
 	return 0;
 }
 
@@ -260,11 +256,11 @@ static int mhdd_readlink(const char *path, char *buf, size_t size)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_readlink: %s, size = %d\n", path, size);
 
-	char *link = find_path(path);
-	if (link) {
+	int dir_id = find_path_id(path);
+	if (dir_id != -1) {
 		memset(buf, 0, size);
-		int res = readlink(link, buf, size);
-		free(link);
+		int res = readlinkat(mhdd.dir_fds[dir_id], rel_path(path),
+			buf, size);
 		if (res >= 0)
 			return 0;
 	}
@@ -280,58 +276,70 @@ static int mhdd_internal_open(const char *file,
 	mhdd_debug(MHDD_INFO, "mhdd_internal_open: %s, flags = 0x%X\n",
 		file, fi->flags);
 	int dir_id, fd;
+	char path[PATH_MAX];
 
-	char *path = find_path(file);
+	if (stats_is_path(file))
+		return what == CREATE_FUNCTION ? -EACCES : stats_open(file, fi);
 
-	if (path) {
+	if ((dir_id = find_path_id(file)) != -1) {
+		if (!dir_path(path, dir_id, file))
+			return -errno;
 		if (what == CREATE_FUNCTION)
-			fd = open(path, fi->flags, mode);
+			fd = openat(mhdd.dir_fds[dir_id], rel_path(file),
+				fi->flags, mode);
 		else
-			fd = open(path, fi->flags);
-		if (fd == -1) {
-			free(path);
+			fd = openat(mhdd.dir_fds[dir_id], rel_path(file),
+				fi->flags);
+		stats_dir(dir_id, STATS_SYSCALLS, 1);
+		if (fd == -1)
 			return -errno;
-		}
 		struct flist *add = flist_create(file, path, fi->flags, fd);
+		add->dir_id = dir_id;
 		fi->fh = add->id;
+		fi->keep_cache = mhdd.keep_cache;
 		flist_unlock();
-		free(path);
 		return 0;
 	}
 
 	mhdd_debug(MHDD_INFO, "mhdd_internal_open: new file %s\n", file);
 
-	if ((dir_id = get_free_dir()) < 0) {
+	if ((dir_id = get_new_dir(file)) < 0) {
 		errno = ENOSPC;
 		return -errno;
 	}
 
 	create_parent_dirs(dir_id, file);
-	path = create_path(mhdd.dirs[dir_id], file);
+	if (!dir_path(path, dir_id, file))
+		return -errno;
 
 	if (what == CREATE_FUNCTION)
-		fd = open(path, fi->flags, mode);
+		fd = openat(mhdd.dir_fds[dir_id], rel_path(file),
+			fi->flags, mode);
 	else
-		fd = open(path, fi->flags);
+		fd = openat(mhdd.dir_fds[dir_id], rel_path(file), fi->flags);
+	stats_dir(dir_id, STATS_SYSCALLS, 1);
 
-	if (fd == -1) {
-		free(path);
+	if (fd == -1)
 		return -errno;
-	}
+
+	pcache_set(file, dir_id);
 
 	if (getuid() == 0) {
 		struct stat st;
-		gid_t gid = fuse_get_context()->gid;
+		uid_t uid;
+		gid_t gid;
+		get_caller(&uid, &gid);
 		if (fstat(fd, &st) == 0) {
 			/* parent directory is SGID'ed */
 			if (st.st_gid != getgid()) gid = st.st_gid;
 		}
-		fchown(fd, fuse_get_context()->uid, gid);
+		fchown(fd, uid, gid);
 	}
 	struct flist *add = flist_create(file, path, fi->flags, fd);
+	add->dir_id = dir_id;
 	fi->fh = add->id;
+	fi->keep_cache = mhdd.keep_cache;
 	flist_unlock();
-	free(path);
 	return 0;
 }
 
@@ -366,6 +374,8 @@ static int mhdd_release(const char *path, struct fuse_file_info *fi)
 	int fh;
 
 	mhdd_debug(MHDD_MSG, "mhdd_release: %s, handle = %lld\n", path, fi->fh);
+	if (fi->fh == STATS_FH)
+		return 0;
 	del = flist_item_by_id_wrlock(fi->fh);
 	if (!del) {
 		mhdd_debug(MHDD_INFO,
@@ -376,6 +386,7 @@ static int mhdd_release(const char *path, struct fuse_file_info *fi)
 
 	fh = del->fh;
 	flist_delete_wrlocked(del);
+	uring_unregister(fh);
 	close(fh);
 	return 0;
 }
@@ -391,12 +402,19 @@ static int mhdd_read(const char *path, char *buf, size_t count, off_t offset,
 			(long long)offset,
 			(long long)count
 		  );
+	if (fi->fh == STATS_FH)
+		return stats_read(buf, count, offset);
 	info = flist_item_by_id(fi->fh);
 	if (!info) {
 		errno = EBADF;
 		return -errno;
 	}
-	res = pread(info->fh, buf, count, offset);
+	policy_io_start(info->dir_id);
+	res = uring_pread(info->fh, buf, count, offset);
+	policy_io_end(info->dir_id);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	if (res > 0)
+		stats_dir(info->dir_id, STATS_BYTES_READ, res);
 	flist_unlock();
 	if (res == -1)
 		return -errno;
@@ -417,49 +435,211 @@ static int mhdd_write(const char *path, const char *buf, size_t count,
 		return -errno;
 	}
 
-	res = pwrite(info->fh, buf, count, offset);
+	policy_io_start(info->dir_id);
+	res = uring_pwrite(info->fh, buf, count, offset);
+	policy_io_end(info->dir_id);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	if (res > 0) {
+		mover_written(info->name, offset, res);
+		fspace_used(info->dir_id, res);
+		stats_dir(info->dir_id, STATS_BYTES_WRITTEN, res);
+	}
 	if ((res == count) || (res == -1 && errno != ENOSPC)) {
-		flist_unlock();
 		if (res == -1) {
 			mhdd_debug(MHDD_DEBUG,
 				"mhdd_write: error write %s: %s\n",
 				info->real_name, strerror(errno));
+			flist_unlock();
 			return -errno;
 		}
+		flist_unlock();
 		return res;
 	}
 
 	// end free space
-	if (move_file(info, offset + count) == 0) {
-		res = pwrite(info->fh, buf, count, offset);
-		flist_unlock();
-		if (res == -1) {
-			mhdd_debug(MHDD_DEBUG,
-				"mhdd_write: error restart write: %s\n",
-				strerror(errno));
+	stats_dir(info->dir_id, STATS_ENOSPC, 1);
+	fspace_refresh(info->dir_id);
+	if (mhdd.move_threads) {
+		/* the list is unlocked while the file is being moved */
+		if (mover_move(info, offset + count) == 0)
+			info = flist_item_by_id(fi->fh);
+		else
+			info = 0;
+		if (!info) {
+			errno = ENOSPC;
 			return -errno;
 		}
-		if (res < count) {
-			mhdd_debug(MHDD_DEBUG,
-				"mhdd_write: error (re)write file %s %s\n",
-				info->real_name,
-				strerror(ENOSPC));
-		}
-		return res;
+	} else if (move_file(info, offset + count) != 0) {
+		errno = ENOSPC;
+		flist_unlock();
+		return -errno;
+	}
+
+	policy_io_start(info->dir_id);
+	res = uring_pwrite(info->fh, buf, count, offset);
+	policy_io_end(info->dir_id);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	if (res == -1) {
+		mhdd_debug(MHDD_DEBUG,
+			"mhdd_write: error restart write: %s\n",
+			strerror(errno));
+		flist_unlock();
+		return -errno;
+	}
+	mover_written(info->name, offset, res);
+	fspace_used(info->dir_id, res);
+	stats_dir(info->dir_id, STATS_BYTES_WRITTEN, res);
+	if (res < count) {
+		mhdd_debug(MHDD_DEBUG,
+			"mhdd_write: error (re)write file %s %s\n",
+			info->real_name,
+			strerror(ENOSPC));
 	}
-	errno = ENOSPC;
 	flist_unlock();
-	return -errno;
+	return res;
 }
 
+#if FUSE_VERSION >= 29
+// io_uring engine does the file io, otherwise libfuse splices it
+static int use_uring(void)
+{
+#ifdef WITH_URING
+	return mhdd.uring_depth > 0;
+#else
+	return 0;
+#endif
+}
+
+// read: give libfuse the fd of the file, it splices the data to the kernel
+static int mhdd_read_buf(const char *path, struct fuse_bufvec **bufp,
+		size_t count, off_t offset, struct fuse_file_info *fi)
+{
+	struct flist *info;
+	struct fuse_bufvec *src;
+
+	mhdd_debug(MHDD_INFO,
+		"mhdd_read_buf: %s, offset = %lld, count = %lld\n",
+		path, (long long)offset, (long long)count);
+	if (fi->fh == STATS_FH) {
+		src = malloc(sizeof(struct fuse_bufvec));
+		*src = FUSE_BUFVEC_INIT(count);
+		src->buf[0].mem = malloc(count);
+		src->buf[0].size = stats_read(src->buf[0].mem, count, offset);
+		*bufp = src;
+		return 0;
+	}
+	info = flist_item_by_id(fi->fh);
+	if (!info) {
+		errno = EBADF;
+		return -errno;
+	}
+
+	/* fd stays valid till release, moving the file dup2's over it */
+	src = malloc(sizeof(struct fuse_bufvec));
+	*src = FUSE_BUFVEC_INIT(count);
+	src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	src->buf[0].fd = info->fh;
+	src->buf[0].pos = offset;
+	/* the bytes are known when libfuse splices them, count the request */
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	stats_dir(info->dir_id, STATS_BYTES_READ, count);
+	flist_unlock();
+
+	*bufp = src;
+	return 0;
+}
+
+// copy the data to memory and write it the usual way
+static int write_buf_mem(const char *path, struct fuse_bufvec *buf,
+		size_t count, off_t offset, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec mem = FUSE_BUFVEC_INIT(count);
+	ssize_t res;
+
+	mem.buf[0].mem = malloc(count);
+	if (!mem.buf[0].mem) {
+		errno = ENOMEM;
+		return -errno;
+	}
+	res = fuse_buf_copy(&mem, buf, 0);
+	if (res >= 0)
+		res = mhdd_write(path, mem.buf[0].mem, res, offset, fi);
+	free(mem.buf[0].mem);
+	return res;
+}
+
+// write: splice the data from the fuse buffer to the file
+static int mhdd_write_buf(const char *path, struct fuse_bufvec *buf,
+		off_t offset, struct fuse_file_info *fi)
+{
+	struct flist *info;
+	struct statvfs st;
+	size_t count = fuse_buf_size(buf);
+	ssize_t res, done;
+
+	mhdd_debug(MHDD_INFO, "mhdd_write_buf: %s, handle = %lld\n",
+		path, fi->fh);
+	info = flist_item_by_id(fi->fh);
+	if (!info) {
+		errno = EBADF;
+		return -errno;
+	}
+
+	/* the file will have to be moved, do not lose the data */
+	if (info->dir_id >= 0 && fspace_statvfs(info->dir_id, &st) == 0 &&
+			(fsblkcnt_t)st.f_bsize * st.f_bavail < count) {
+		flist_unlock();
+		return write_buf_mem(path, buf, count, offset, fi);
+	}
+
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(count);
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = info->fh;
+	dst.buf[0].pos = offset;
+
+	policy_io_start(info->dir_id);
+	res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+	policy_io_end(info->dir_id);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	if (res > 0) {
+		mover_written(info->name, offset, res);
+		fspace_used(info->dir_id, res);
+		stats_dir(info->dir_id, STATS_BYTES_WRITTEN, res);
+	}
+	flist_unlock();
+	if (res == count || (res < 0 && res != -ENOSPC))
+		return res;
+
+	/* end free space: the rest is left in buf, mhdd_write moves the file */
+	done = res > 0 ? res : 0;
+	res = write_buf_mem(path, buf, count - done, offset + done, fi);
+	if (res < 0)
+		return done ? done : res;
+	return done + res;
+}
+#endif
+
 // truncate
 static int mhdd_truncate(const char *path, off_t size)
 {
-	char *file = find_path(path);
+	char file[PATH_MAX];
+	int dir_id = find_path_id(path);
 	mhdd_debug(MHDD_MSG, "mhdd_truncate: %s\n", path);
-	if (file) {
-		int res = truncate(file, size);
-		free(file);
+	if (dir_id != -1 && dir_path(file, dir_id, path)) {
+		struct stat st;
+		/* the file can be moved meanwhile */
+		flist_rdlock();
+		int res = fstatat(mhdd.dir_fds[dir_id], rel_path(path), &st,
+			AT_SYMLINK_NOFOLLOW);
+		/* there is no truncateat */
+		if (res == 0)
+			res = truncate(file, size);
+		if (res == 0) {
+			mover_written(path, size, -1);
+			if (st.st_size > size)
+				fspace_used(dir_id, size - st.st_size);
+		}
+		flist_unlock();
 		if (res == -1)
 			return -errno;
 		return 0;
@@ -484,21 +664,132 @@ static int mhdd_ftruncate(const char *path, off_t size,
 	}
 
 	int fh = info->fh;
-	res = ftruncate(fh, size);
+	struct stat st;
+	res = fstat(fh, &st);
+	if (res == 0)
+		res = ftruncate(fh, size);
+	if (res == 0) {
+		mover_written(info->name, size, -1);
+		if (st.st_size > size)
+			fspace_used(info->dir_id, size - st.st_size);
+	}
 	flist_unlock();
 	if (res == -1)
 		return -errno;
 	return 0;
 }
 
+#if FUSE_VERSION >= 29
+// bytes fallocate may add to the file, and the size the file needs
+// on a dir it is moved to (*need)
+static off_t fallocate_size(int fh, int mode, off_t offset, off_t len,
+		off_t *need)
+{
+	struct stat st;
+
+	*need = offset + len;
+#ifdef FALLOC_FL_PUNCH_HOLE
+	/* deallocating modes free space, they never need it */
+	if (mode & FALLOC_FL_PUNCH_HOLE)
+		return 0;
+#endif
+#ifdef FALLOC_FL_COLLAPSE_RANGE
+	if (mode & FALLOC_FL_COLLAPSE_RANGE)
+		return 0;
+#endif
+	if (fstat(fh, &st) != 0)
+		return len;
+	/* inside a file without holes nothing is allocated */
+	if (offset + len <= st.st_size &&
+			(off_t)st.st_blocks * 512 >= st.st_size)
+		return 0;
+#ifdef FALLOC_FL_KEEP_SIZE
+	/* the size stays: the blocks past it are only space needed */
+	if (mode & FALLOC_FL_KEEP_SIZE)
+		*need = st.st_size + len;
+#endif
+	return len;
+}
+
+// fallocate: the file is moved before, not in the middle of the writes
+static int mhdd_fallocate(const char *path, int mode, off_t offset,
+		off_t len, struct fuse_file_info *fi)
+{
+	int res;
+	off_t size, need;
+	struct statvfs st;
+	struct flist *info;
+	mhdd_debug(MHDD_MSG, "mhdd_fallocate: %s, handle = %lld, "
+		"offset = %lld, len = %lld\n", path, fi->fh,
+		(long long)offset, (long long)len);
+	if (fi->fh == STATS_FH)
+		return -EBADF;
+#ifndef __NR_fallocate
+	return -EOPNOTSUPP;
+#else
+	info = flist_item_by_id(fi->fh);
+	if (!info) {
+		errno = EBADF;
+		return -errno;
+	}
+
+	size = fallocate_size(info->fh, mode, offset, len, &need);
+	if (size && fspace_statvfs(info->dir_id, &st) == 0 &&
+			(fsblkcnt_t)st.f_bsize * st.f_bavail < size) {
+		mhdd_debug(MHDD_INFO, "mhdd_fallocate: no space for %lld "
+			"bytes on %s\n", (long long)size,
+			mhdd.dirs[info->dir_id]);
+		stats_dir(info->dir_id, STATS_ENOSPC, 1);
+		fspace_refresh(info->dir_id);
+		if (mhdd.move_threads) {
+			/* the list is unlocked while the file is being moved */
+			if (mover_move(info, need) == 0)
+				info = flist_item_by_id(fi->fh);
+			else
+				info = 0;
+			if (!info) {
+				errno = ENOSPC;
+				return -errno;
+			}
+		} else if (move_file(info, need) != 0) {
+			errno = ENOSPC;
+			flist_unlock();
+			return -errno;
+		}
+	}
+
+	res = syscall(__NR_fallocate, info->fh, mode, offset, len);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
+	if (res == 0) {
+		mover_written(info->name, offset, len);
+		if (size)
+			fspace_used(info->dir_id, size);
+	} else if (errno == ENOSPC) {
+		stats_dir(info->dir_id, STATS_ENOSPC, 1);
+	}
+	flist_unlock();
+	if (res == -1)
+		return -errno;
+	return 0;
+#endif
+}
+#endif
+
 // access
 static int mhdd_access(const char *path, int mask)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_access: %s mode = %04X\n", path, mask);
-	char *file = find_path(path);
-	if (file) {
-		int res = access(file, mask);
-		free(file);
+	if (stats_is_path(path)) {
+		struct stat st;
+		int res = stats_getattr(path, &st);
+		if (res == 0 && (mask & W_OK))
+			res = -EACCES;
+		return res;
+	}
+	int dir_id = find_path_id(path);
+	if (dir_id != -1) {
+		int res = faccessat(mhdd.dir_fds[dir_id], rel_path(path),
+			mask, 0);
 		if (res == -1)
 			return -errno;
 		return 0;
@@ -513,47 +804,50 @@ static int mhdd_mkdir(const char * path, mode_t mode)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_mkdir: %s mode = %04X\n", path, mode);
 
+	int res = stats_reserved(path);
+	if (res)
+		return res;
 	if (find_path_id(path) != -1) {
 		errno = EEXIST;
 		return -errno;
 	}
 
-	char *parent = get_parent_path(path);
-	if (!parent) {
+	char parent[PATH_MAX];
+	if (!path_parent(parent, path)) {
 		errno = EFAULT;
 		return -errno;
 	}
 
 	if (find_path_id(parent) == -1) {
-		free(parent);
 		errno = EFAULT;
 		return -errno;
 	}
-	free(parent);
 
-	int dir_id = get_free_dir();
+	int dir_id = get_new_dir(path);
 	if (dir_id<0) {
 		errno = ENOSPC;
 		return -errno;
 	}
 
 	create_parent_dirs(dir_id, path);
-	char *name = create_path(mhdd.dirs[dir_id], path);
-	if (mkdir(name, mode) == 0) {
+	int fd = mhdd.dir_fds[dir_id];
+	const char *name = rel_path(path);
+	if (mkdirat(fd, name, mode) == 0) {
+		pcache_set(path, dir_id);
 		if (getuid() == 0) {
 			struct stat st;
-			gid_t gid = fuse_get_context()->gid;
-			if (lstat(name, &st) == 0) {
+			uid_t uid;
+			gid_t gid;
+			get_caller(&uid, &gid);
+			if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
 				/* parent directory is SGID'ed */
 				if (st.st_gid != getgid())
 					gid = st.st_gid;
 			}
-			chown(name, fuse_get_context()->uid, gid);
+			fchownat(fd, name, uid, gid, 0);
 		}
-		free(name);
 		return 0;
 	}
-	free(name);
 	return -errno;
 }
 
@@ -561,10 +855,11 @@ static int mhdd_mkdir(const char * path, mode_t mode)
 static int mhdd_rmdir(const char * path)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_rmdir: %s\n", path);
-	char *dir;
-	while((dir = find_path(path))) {
-		int res = rmdir(dir);
-		free(dir);
+	int dir_id;
+	while((dir_id = find_path_id(path)) != -1) {
+		int res = unlinkat(mhdd.dir_fds[dir_id], rel_path(path),
+			AT_REMOVEDIR);
+		pcache_forget(path);
 		if (res == -1) return -errno;
 	}
 	return 0;
@@ -574,114 +869,162 @@ static int mhdd_rmdir(const char * path)
 static int mhdd_unlink(const char *path)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_unlink: %s\n", path);
-	char *file = find_path(path);
-	if (!file) {
+	int dir_id = find_path_id(path);
+	if (dir_id == -1) {
 		errno = ENOENT;
 		return -errno;
 	}
-	int res = unlink(file);
-	free(file);
+	int res = unlinkat(mhdd.dir_fds[dir_id], rel_path(path), 0);
+	pcache_forget(path);
 	if (res == -1) return -errno;
 	return 0;
 }
 
 // rename
+// what rename finds in one dir
+struct rename_dir
+{
+	char    to_is_dir, to_is_file, to_not_empty;
+	char    from_is_dir, from_is_file;
+};
+
+struct rename_probe
+{
+	char                *from, *to;
+	struct rename_dir   dirs[];
+};
+
+static void rename_probe_dir(void *data, int i)
+{
+	struct rename_probe *probe = data;
+	struct rename_dir *rd = probe->dirs + i;
+	struct stat st;
+
+	int fd = mhdd.dir_fds[i];
+	const char *obj_to   = rel_path(probe->to);
+	const char *obj_from = rel_path(probe->from);
+	if (fstatat(fd, obj_to, &st, 0) == 0) {
+		if (S_ISDIR(st.st_mode)) {
+			rd->to_is_dir = 1;
+			if (!dir_is_empty(fd, obj_to))
+				rd->to_not_empty = 1;
+		}
+		else
+			rd->to_is_file = 1;
+	}
+	if (fstatat(fd, obj_from, &st, 0) == 0) {
+		if (S_ISDIR (st.st_mode))
+			rd->from_is_dir = 1;
+		else
+			rd->from_is_file = 1;
+	}
+}
+
 static int mhdd_rename(const char *from, const char *to)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_rename: from = %s to = %s\n", from, to);
 
 	int i, res;
 	struct stat sto, sfrom;
-	char *obj_from, *obj_to;
+	const char *obj_from = rel_path(from), *obj_to = rel_path(to);
 	int from_is_dir = 0, to_is_dir = 0, from_is_file = 0, to_is_file = 0;
+
+	if (stats_is_path(from))
+		return -EPERM;
+	if ((res = stats_reserved(to)) != 0)
+		return res;
 	int to_dir_is_empty = 1;
 
 	if (strcmp(from, to) == 0)
 		return 0;
 
 	/* seek for possible errors */
-	for (i = 0; i < mhdd.cdirs; i++) {
-		obj_to   = create_path(mhdd.dirs[i], to);
-		obj_from = create_path(mhdd.dirs[i], from);
-		if (stat(obj_to, &sto) == 0) {
-			if (S_ISDIR(sto.st_mode)) {
-				to_is_dir++;
-				if (!dir_is_empty(obj_to))
-					to_dir_is_empty = 0;
-			}
-			else
-				to_is_file++;
-		}
-		if (stat(obj_from, &sfrom) == 0) {
-			if (S_ISDIR (sfrom.st_mode))
-				from_is_dir++;
-			else
-				from_is_file++;
-		}
-		free(obj_from);
-		free(obj_to);
+	struct rename_probe *probe = calloc(1, sizeof(struct rename_probe) +
+		mhdd.cdirs * sizeof(struct rename_dir) +
+		strlen(from) + strlen(to) + 2);
+	probe->from = (char *)(probe->dirs + mhdd.cdirs);
+	probe->to = probe->from + strlen(from) + 1;
+	strcpy(probe->from, from);
+	strcpy(probe->to, to);
+
+	struct tpool_batch *batch = 0;
+	if (mhdd.parallel_lookup)
+		batch = tpool_start(rename_probe_dir, probe, mhdd.cdirs);
+
+	for (i = res = 0; i < mhdd.cdirs && !res; i++) {
+		struct rename_dir *rd = probe->dirs + i;
+
+		if (batch)
+			tpool_wait(batch, i);
+		else
+			rename_probe_dir(probe, i);
+
+		to_is_dir += rd->to_is_dir;
+		to_is_file += rd->to_is_file;
+		from_is_dir += rd->from_is_dir;
+		from_is_file += rd->from_is_file;
+		if (rd->to_not_empty)
+			to_dir_is_empty = 0;
 
 		if (to_is_file && from_is_dir)
-			return -ENOTDIR;
-		if (to_is_file && to_is_dir)
-			return -ENOTEMPTY;
-		if (from_is_dir && !to_dir_is_empty)
-			return -ENOTEMPTY;
+			res = -ENOTDIR;
+		else if (to_is_file && to_is_dir)
+			res = -ENOTEMPTY;
+		else if (from_is_dir && !to_dir_is_empty)
+			res = -ENOTEMPTY;
 	}
 
+	if (batch)
+		tpool_free(batch);
+	else
+		free(probe);
+	if (res)
+		return res;
+
 	/* parent 'to' path doesn't exists */
-	char *pto = get_parent_path (to);
-	if (find_path_id(pto) == -1) {
-		free (pto);
+	char pto[PATH_MAX];
+	if (!path_parent(pto, to) || find_path_id(pto) == -1)
 		return -ENOENT;
-	}
-	free (pto);
+
+	/* cached locations of the objects (and their children) go stale */
+	if (from_is_dir)
+		pcache_flush();
+	pcache_forget(from);
+	pcache_forget(to);
 
 	/* rename cycle */
 	for (i = 0; i < mhdd.cdirs; i++) {
-		obj_to   = create_path(mhdd.dirs[i], to);
-		obj_from = create_path(mhdd.dirs[i], from);
-		if (stat(obj_from, &sfrom) == 0) {
+		int fd = mhdd.dir_fds[i];
+		if (fstatat(fd, obj_from, &sfrom, 0) == 0) {
 			/* if from is dir and at the same time file,
 			   we only rename dir */
 			if (from_is_dir && from_is_file) {
-				if (!S_ISDIR(sfrom.st_mode)) {
-					free(obj_from);
-					free(obj_to);
+				if (!S_ISDIR(sfrom.st_mode))
 					continue;
-				}
 			}
 
 			create_parent_dirs(i, to);
 
-			mhdd_debug(MHDD_MSG, "mhdd_rename: rename %s -> %s\n",
-				obj_from, obj_to);
-			res = rename(obj_from, obj_to);
-			if (res == -1) {
-				free(obj_from);
-				free(obj_to);
+			mhdd_debug(MHDD_MSG, "mhdd_rename: rename %s -> %s "
+				"on %s\n", from, to, mhdd.dirs[i]);
+			res = renameat(fd, obj_from, fd, obj_to);
+			if (res == -1)
 				return -errno;
-			}
 		} else {
 			/* from and to are files, so we must remove to files */
 			if (from_is_file && to_is_file && !from_is_dir) {
-				if (stat(obj_to, &sto) == 0) {
+				if (fstatat(fd, obj_to, &sto, 0) == 0) {
 					mhdd_debug(MHDD_MSG,
-						"mhdd_rename: unlink %s\n",
-						obj_to);
-					if (unlink(obj_to) == -1) {
-						free(obj_from);
-						free(obj_to);
+						"mhdd_rename: unlink %s on %s\n",
+						to, mhdd.dirs[i]);
+					if (unlinkat(fd, obj_to, 0) == -1)
 						return -errno;
-					}
 				}
 			}
 		}
-
-		free(obj_from);
-		free(obj_to);
 	}
 
+	flist_rename(from, to, from_is_dir);
 	return 0;
 }
 
@@ -692,23 +1035,15 @@ static int mhdd_utimens(const char *path, const struct timespec ts[2])
 	int i, res, flag_found;
 
 	for (i = flag_found = 0; i<mhdd.cdirs; i++) {
-		char *object = create_path(mhdd.dirs[i], path);
+		const char *object = rel_path(path);
 		struct stat st;
-		if (lstat(object, &st) != 0) {
-			free(object);
+		if (fstatat(mhdd.dir_fds[i], object, &st,
+				AT_SYMLINK_NOFOLLOW) != 0)
 			continue;
-		}
 
 		flag_found = 1;
-		struct timeval tv[2];
-
-		tv[0].tv_sec = ts[0].tv_sec;
-		tv[0].tv_usec = ts[0].tv_nsec / 1000;
-		tv[1].tv_sec = ts[1].tv_sec;
-		tv[1].tv_usec = ts[1].tv_nsec / 1000;
-
-		res = lutimes(object, tv);
-		free(object);
+		res = utimensat(mhdd.dir_fds[i], object, ts,
+			AT_SYMLINK_NOFOLLOW);
 		if (res == -1)
 			return -errno;
 	}
@@ -725,16 +1060,14 @@ static int mhdd_chmod(const char *path, mode_t mode)
 	int i, res, flag_found;
 
 	for (i = flag_found = 0; i<mhdd.cdirs; i++) {
-		char *object = create_path(mhdd.dirs[i], path);
+		const char *object = rel_path(path);
 		struct stat st;
-		if (lstat(object, &st) != 0) {
-			free(object);
+		if (fstatat(mhdd.dir_fds[i], object, &st,
+				AT_SYMLINK_NOFOLLOW) != 0)
 			continue;
-		}
 
 		flag_found = 1;
-		res = chmod(object, mode);
-		free(object);
+		res = fchmodat(mhdd.dir_fds[i], object, mode, 0);
 		if (res == -1)
 			return -errno;
 	}
@@ -752,16 +1085,15 @@ static int mhdd_chown(const char *path, uid_t uid, gid_t gid)
 	int i, res, flag_found;
 
 	for (i = flag_found = 0; i < mhdd.cdirs; i++) {
-		char *object = create_path(mhdd.dirs[i], path);
+		const char *object = rel_path(path);
 		struct stat st;
-		if (lstat(object, &st) != 0) {
-			free(object);
+		if (fstatat(mhdd.dir_fds[i], object, &st,
+				AT_SYMLINK_NOFOLLOW) != 0)
 			continue;
-		}
 
 		flag_found = 1;
-		res = lchown(object, uid, gid);
-		free(object);
+		res = fchownat(mhdd.dir_fds[i], object, uid, gid,
+			AT_SYMLINK_NOFOLLOW);
 		if (res == -1)
 			return -errno;
 	}
@@ -776,23 +1108,25 @@ static int mhdd_symlink(const char *from, const char *to)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_symlink: from = %s to = %s\n", from, to);
 	int i, res;
-	char *parent = get_parent_path(to);
-	if (!parent) {
+	char parent[PATH_MAX];
+	if ((res = stats_reserved(to)) != 0)
+		return res;
+	if (!path_parent(parent, to)) {
 		errno = ENOENT;
 		return -errno;
 	}
 
 	int dir_id = find_path_id(parent);
-	free(parent);
 
 	if (dir_id == -1) {
 		errno = ENOENT;
 		return -errno;
 	}
 
-	for (i = 0; i < 2; i++) {
+	/* the policies place new entries themselves */
+	for (i = mhdd.placement == PLACEMENT_MLIMIT ? 0 : 1; i < 2; i++) {
 		if (i) {
-			if ((dir_id = get_free_dir()) < 0) {
+			if ((dir_id = get_new_dir(to)) < 0) {
 				errno = ENOSPC;
 				return -errno;
 			}
@@ -800,12 +1134,11 @@ static int mhdd_symlink(const char *from, const char *to)
 			create_parent_dirs(dir_id, to);
 		}
 
-		char *path_to = create_path(mhdd.dirs[dir_id], to);
-
-		res = symlink(from, path_to);
-		free(path_to);
-		if (res == 0)
+		res = symlinkat(from, mhdd.dir_fds[dir_id], rel_path(to));
+		if (res == 0) {
+			pcache_set(to, dir_id);
 			return 0;
+		}
 		if (errno != ENOSPC)
 			return -errno;
 	}
@@ -817,6 +1150,9 @@ static int mhdd_link(const char *from, const char *to)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_link: from = %s to = %s\n", from, to);
 
+	int res = stats_reserved(to);
+	if (res)
+		return res;
 	int dir_id = find_path_id(from);
 
 	if (dir_id == -1) {
@@ -824,20 +1160,18 @@ static int mhdd_link(const char *from, const char *to)
 		return -errno;
 	}
 
-	int res = create_parent_dirs(dir_id, to);
+	res = create_parent_dirs(dir_id, to);
 	if (res != 0) {
 		return res;
 	}
 
-	char *path_from = create_path(mhdd.dirs[dir_id], from);
-	char *path_to = create_path(mhdd.dirs[dir_id], to);
+	res = linkat(mhdd.dir_fds[dir_id], rel_path(from),
+		mhdd.dir_fds[dir_id], rel_path(to), 0);
 
-	res = link(path_from, path_to);
-	free(path_from);
-	free(path_to);
-
-	if (res == 0)
+	if (res == 0) {
+		pcache_set(to, dir_id);
 		return 0;
+	}
 	return -errno;
 }
 
@@ -845,52 +1179,55 @@ static int mhdd_link(const char *from, const char *to)
 static int mhdd_mknod(const char *path, mode_t mode, dev_t rdev)
 {
 	mhdd_debug(MHDD_MSG, "mhdd_mknod: path = %s mode = %X\n", path, mode);
-	int res, i;
-	char *nod;
+	int res, i, fd;
+	const char *nod = rel_path(path);
+
+	if ((res = stats_reserved(path)) != 0)
+		return res;
 
-	char *parent = get_parent_path(path);
-	if (!parent) {
+	char parent[PATH_MAX];
+	if (!path_parent(parent, path)) {
 		errno = ENOENT;
 		return -errno;
 	}
 
 	int dir_id = find_path_id(parent);
-	free(parent);
 
 	if (dir_id == -1) {
 		errno = ENOENT;
 		return -errno;
 	}
 
-	for (i = 0; i < 2; i++) {
+	/* the policies place new entries themselves */
+	for (i = mhdd.placement == PLACEMENT_MLIMIT ? 0 : 1; i < 2; i++) {
 		if (i) {
-			if ((dir_id = get_free_dir())<0) {
+			if ((dir_id = get_new_dir(path))<0) {
 				errno = ENOSPC;
 				return -errno;
 			}
 			create_parent_dirs(dir_id, path);
 		}
-		nod = create_path(mhdd.dirs[dir_id], path);
+		fd = mhdd.dir_fds[dir_id];
 
 		if (S_ISREG(mode)) {
-			res = open(nod, O_CREAT | O_EXCL | O_WRONLY, mode);
+			res = openat(fd, nod, O_CREAT | O_EXCL | O_WRONLY, mode);
 			if (res >= 0)
 				res = close(res);
 		} else if (S_ISFIFO(mode))
-			res = mkfifo(nod, mode);
+			res = mkfifoat(fd, nod, mode);
 		else
-			res = mknod(nod, mode, rdev);
+			res = mknodat(fd, nod, mode, rdev);
 
 		if (res != -1) {
+			pcache_set(path, dir_id);
 			if (getuid() == 0) {
-				struct fuse_context * fcontext =
-					fuse_get_context();
-				chown(nod, fcontext->uid, fcontext->gid);
+				uid_t uid;
+				gid_t gid;
+				get_caller(&uid, &gid);
+				fchownat(fd, nod, uid, gid, 0);
 			}
-			free(nod);
 			return 0;
 		}
-		free(nod);
 		if (errno != ENOSPC)
 			return -errno;
 	}
@@ -910,6 +1247,8 @@ static int mhdd_fsync(const char *path, int isdatasync,
 	struct flist *info;
 	mhdd_debug(MHDD_MSG,
 		"mhdd_fsync: path = %s handle = %llu\n", path, fi->fh);
+	if (fi->fh == STATS_FH)
+		return 0;
 	info = flist_item_by_id(fi->fh);
 	int res;
 	if (!info) {
@@ -919,12 +1258,14 @@ static int mhdd_fsync(const char *path, int isdatasync,
 
 	int fh = info->fh;
 
+	policy_io_start(info->dir_id);
 #ifdef HAVE_FDATASYNC
-	if (isdatasync)
-		res = fdatasync(fh);
-	else
+	res = uring_fsync(fh, isdatasync);
+#else
+	res = uring_fsync(fh, 0);
 #endif
-		res = fsync(fh);
+	policy_io_end(info->dir_id);
+	stats_dir(info->dir_id, STATS_SYSCALLS, 1);
 
 	flist_unlock();
 	if (res == -1)
@@ -938,15 +1279,14 @@ static int mhdd_fsync(const char *path, int isdatasync,
 static int mhdd_setxattr(const char *path, const char *attrname,
                 const char *attrval, size_t attrvalsize, int flags)
 {
-	char * real_path = find_path(path);
-	if (!real_path)
+	char real_path[PATH_MAX];
+	if (!find_path_buf(real_path, path))
 		return -ENOENT;
 
 	mhdd_debug(MHDD_MSG,
 		"mhdd_setxattr: path = %s name = %s value = %s size = %d\n",
                 real_path, attrname, attrval, attrvalsize);
         int res = setxattr(real_path, attrname, attrval, attrvalsize, flags);
-        free(real_path);
         if (res == -1) return -errno;
         return 0;
 }
@@ -956,15 +1296,16 @@ static int mhdd_setxattr(const char *path, const char *attrname,
 static int mhdd_getxattr(const char *path, const char *attrname, char *buf, size_t count)
 {
         int size = 0;
-	char * real_path = find_path(path);
-	if (!real_path)
+	if (stats_is_path(path))
+		return -ENODATA;
+	char real_path[PATH_MAX];
+	if (!find_path_buf(real_path, path))
 		return -ENOENT;
 
 	mhdd_debug(MHDD_MSG,
 		"mhdd_getxattr: path = %s name = %s bufsize = %d\n",
                 real_path, attrname, count);
         size = getxattr(real_path, attrname, buf, count);
-        free(real_path);
         if (size == -1) return -errno;
         return size;
 }
@@ -974,8 +1315,10 @@ static int mhdd_getxattr(const char *path, const char *attrname, char *buf, size
 static int mhdd_listxattr(const char *path, char *buf, size_t count)
 {
         int ret = 0;
-	char * real_path = find_path(path);
-	if (!real_path)
+	if (stats_is_path(path))
+		return 0;
+	char real_path[PATH_MAX];
+	if (!find_path_buf(real_path, path))
 		return -ENOENT;
 
 	mhdd_debug(MHDD_MSG,
@@ -983,7 +1326,6 @@ static int mhdd_listxattr(const char *path, char *buf, size_t count)
                 real_path, count);
 
         ret=listxattr(real_path, buf, count);
-        free(real_path);
         if (ret == -1) return -errno;
         return ret;
 }
@@ -992,8 +1334,8 @@ static int mhdd_listxattr(const char *path, char *buf, size_t count)
 #ifndef WITHOUT_XATTR
 static int mhdd_removexattr(const char *path, const char *attrname)
 {
-	char * real_path = find_path(path);
-	if (!real_path)
+	char real_path[PATH_MAX];
+	if (!find_path_buf(real_path, path))
 		return -ENOENT;
 
 	mhdd_debug(MHDD_MSG,
@@ -1001,51 +1343,184 @@ static int mhdd_removexattr(const char *path, const char *attrname)
                 real_path, attrname);
 
         int res = removexattr(real_path, attrname);
-        free(real_path);
         if (res == -1) return -errno;
         return 0;
 }
 #endif
 
+// mount (after daemonizing)
+static void * mhdd_init(struct fuse_conn_info *conn)
+{
+#if FUSE_VERSION >= 29
+	if (!use_uring())
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ |
+			FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+#endif
+#ifdef FUSE_CAP_AUTO_INVAL_DATA
+	/* cached pages are dropped when the file changes under mhddfs,
+	   libfuse checks it itself in the path based interface */
+	if (mhdd.lowlevel && mhdd.auto_cache)
+		conn->want |= conn->capable & FUSE_CAP_AUTO_INVAL_DATA;
+#endif
+	mhdd_debug_start();
+	fspace_init(mhdd.space_refresh);
+	mover_init(mhdd.move_threads);
+	tpool_init(mhdd.scan_threads);
+	uring_init(mhdd.uring_depth);
+	policy_init();
+	pindex_init(mhdd.index_file, mhdd.index_size);
+	/* a stale index is rebuilt by the warmup */
+	if (mhdd.warmup || !pindex_complete())
+		warmup_start(mhdd.warmup_rate);
+	watch_init();
+	stats_start();
+	return 0;
+}
+
+// umount
+static void mhdd_destroy(void *data)
+{
+	size_t len;
+	char *text = stats_text(&len);
+
+	mhdd_debug(MHDD_MSG, "mhdd_destroy: stats:\n%s", text);
+	free(text);
+	watch_stop();
+	warmup_stop();
+	/* the mover uses the others and the index */
+	mover_stop();
+	tpool_stop();
+	uring_stop();
+	fspace_stop();
+	pindex_close();
+	mhdd_debug_flush();
+}
+
+// handlers timed for the stats
+#define TIMED(op, name, proto, args) \
+static int timed_##name proto \
+{ \
+	uint64_t start = stats_now(); \
+	int res = mhdd_##name args; \
+	stats_op(op, start, res); \
+	return res; \
+}
+
+TIMED(STATS_GETATTR, stat, (const char *p, struct stat *st), (p, st))
+TIMED(STATS_STATFS, statfs, (const char *p, struct statvfs *st), (p, st))
+TIMED(STATS_READDIR, readdir, (const char *p, void *buf,
+	fuse_fill_dir_t filler, off_t off, struct fuse_file_info *fi),
+	(p, buf, filler, off, fi))
+TIMED(STATS_READLINK, readlink, (const char *p, char *buf, size_t size),
+	(p, buf, size))
+TIMED(STATS_OPEN, fileopen, (const char *p, struct fuse_file_info *fi),
+	(p, fi))
+TIMED(STATS_RELEASE, release, (const char *p, struct fuse_file_info *fi),
+	(p, fi))
+TIMED(STATS_READ, read, (const char *p, char *buf, size_t count,
+	off_t off, struct fuse_file_info *fi), (p, buf, count, off, fi))
+TIMED(STATS_WRITE, write, (const char *p, const char *buf, size_t count,
+	off_t off, struct fuse_file_info *fi), (p, buf, count, off, fi))
+TIMED(STATS_CREATE, create, (const char *p, mode_t mode,
+	struct fuse_file_info *fi), (p, mode, fi))
+TIMED(STATS_TRUNCATE, truncate, (const char *p, off_t size), (p, size))
+TIMED(STATS_FTRUNCATE, ftruncate, (const char *p, off_t size,
+	struct fuse_file_info *fi), (p, size, fi))
+TIMED(STATS_ACCESS, access, (const char *p, int mask), (p, mask))
+TIMED(STATS_MKDIR, mkdir, (const char *p, mode_t mode), (p, mode))
+TIMED(STATS_RMDIR, rmdir, (const char *p), (p))
+TIMED(STATS_UNLINK, unlink, (const char *p), (p))
+TIMED(STATS_RENAME, rename, (const char *from, const char *to), (from, to))
+TIMED(STATS_UTIMENS, utimens, (const char *p, const struct timespec ts[2]),
+	(p, ts))
+TIMED(STATS_CHMOD, chmod, (const char *p, mode_t mode), (p, mode))
+TIMED(STATS_CHOWN, chown, (const char *p, uid_t uid, gid_t gid),
+	(p, uid, gid))
+TIMED(STATS_SYMLINK, symlink, (const char *from, const char *to), (from, to))
+TIMED(STATS_MKNOD, mknod, (const char *p, mode_t mode, dev_t rdev),
+	(p, mode, rdev))
+TIMED(STATS_FSYNC, fsync, (const char *p, int isdatasync,
+	struct fuse_file_info *fi), (p, isdatasync, fi))
+TIMED(STATS_LINK, link, (const char *from, const char *to), (from, to))
+#if FUSE_VERSION >= 29
+TIMED(STATS_READ_BUF, read_buf, (const char *p, struct fuse_bufvec **bufp,
+	size_t count, off_t off, struct fuse_file_info *fi),
+	(p, bufp, count, off, fi))
+TIMED(STATS_WRITE_BUF, write_buf, (const char *p, struct fuse_bufvec *buf,
+	off_t off, struct fuse_file_info *fi), (p, buf, off, fi))
+TIMED(STATS_FALLOCATE, fallocate, (const char *p, int mode, off_t off,
+	off_t len, struct fuse_file_info *fi), (p, mode, off, len, fi))
+#endif
+#ifndef WITHOUT_XATTR
+TIMED(STATS_SETXATTR, setxattr, (const char *p, const char *name,
+	const char *value, size_t size, int flags),
+	(p, name, value, size, flags))
+TIMED(STATS_GETXATTR, getxattr, (const char *p, const char *name,
+	char *buf, size_t count), (p, name, buf, count))
+TIMED(STATS_LISTXATTR, listxattr, (const char *p, char *buf, size_t count),
+	(p, buf, count))
+TIMED(STATS_REMOVEXATTR, removexattr, (const char *p, const char *name),
+	(p, name))
+#endif
+
 // functions links
 static struct fuse_operations mhdd_oper = {
-	.getattr    	= mhdd_stat,
-	.statfs     	= mhdd_statfs,
-	.readdir    	= mhdd_readdir,
-	.readlink   	= mhdd_readlink,
-	.open       	= mhdd_fileopen,
-	.release    	= mhdd_release,
-	.read       	= mhdd_read,
-	.write      	= mhdd_write,
-	.create     	= mhdd_create,
-	.truncate   	= mhdd_truncate,
-	.ftruncate  	= mhdd_ftruncate,
-	.access     	= mhdd_access,
-	.mkdir      	= mhdd_mkdir,
-	.rmdir      	= mhdd_rmdir,
-	.unlink     	= mhdd_unlink,
-	.rename     	= mhdd_rename,
-	.utimens    	= mhdd_utimens,
-	.chmod      	= mhdd_chmod,
-	.chown      	= mhdd_chown,
-	.symlink    	= mhdd_symlink,
-	.mknod      	= mhdd_mknod,
-	.fsync      	= mhdd_fsync,
-	.link		= mhdd_link,
+	.getattr    	= timed_stat,
+	.statfs     	= timed_statfs,
+	.readdir    	= timed_readdir,
+	.readlink   	= timed_readlink,
+	.open       	= timed_fileopen,
+	.release    	= timed_release,
+	.read       	= timed_read,
+	.write      	= timed_write,
+	.create     	= timed_create,
+	.truncate   	= timed_truncate,
+	.ftruncate  	= timed_ftruncate,
+	.access     	= timed_access,
+	.mkdir      	= timed_mkdir,
+	.rmdir      	= timed_rmdir,
+	.unlink     	= timed_unlink,
+	.rename     	= timed_rename,
+	.utimens    	= timed_utimens,
+	.chmod      	= timed_chmod,
+	.chown      	= timed_chown,
+	.symlink    	= timed_symlink,
+	.mknod      	= timed_mknod,
+	.fsync      	= timed_fsync,
+	.link		= timed_link,
+#if FUSE_VERSION >= 29
+	.read_buf	= timed_read_buf,
+	.write_buf	= timed_write_buf,
+	.fallocate	= timed_fallocate,
+#endif
+	.init		= mhdd_init,
+	.destroy	= mhdd_destroy,
 #ifndef WITHOUT_XATTR
-        .setxattr   	= mhdd_setxattr,
-        .getxattr   	= mhdd_getxattr,
-        .listxattr  	= mhdd_listxattr,
-        .removexattr	= mhdd_removexattr,
+        .setxattr   	= timed_setxattr,
+        .getxattr   	= timed_getxattr,
+        .listxattr  	= timed_listxattr,
+        .removexattr	= timed_removexattr,
 #endif
 };
 
 
 // start
+#ifndef MHDDFS_DRIVER
 int main(int argc, char *argv[])
 {
 	mhdd_debug_init();
+	stats_init();
 	struct fuse_args *args = parse_options(argc, argv);
 	flist_init();
+	pcache_init(mhdd.cache_size);
+#if FUSE_VERSION >= 29
+	if (use_uring()) {
+		mhdd_oper.read_buf = 0;
+		mhdd_oper.write_buf = 0;
+	}
+#endif
+	if (mhdd.lowlevel)
+		return lowlevel_main(args, &mhdd_oper);
 	return fuse_main(args->argc, args->argv, &mhdd_oper, 0);
 }
+#endif
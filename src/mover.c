@@ -0,0 +1,559 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+
+#include <uthash.h>
+
+#include "mover.h"
+#include "tools.h"
+#include "debug.h"
+#include "parse_options.h"
+#include "pcache.h"
+#include "fspace.h"
+#include "stats.h"
+#include "policy.h"
+
+/*
+   The data is copied without the flist lock into a hidden file (see
+   move_tmp_open), writes to the file done meanwhile are remembered as
+   dirty ranges.  At the end the list is wrlocked, the dirty ranges are
+   copied again, the copy gets the name and opened files are switched
+   to it.
+
+   Lock order: flist lock, then jobs_lock.
+*/
+
+#define MOVER_MAX_RANGES 1024
+
+struct move_range
+{
+	off_t start;
+	off_t end;      // -1 - till the end of file
+};
+
+struct move_job
+{
+	char                *name;
+	off_t               wsize;
+	int                 refs;
+	int                 tracking;
+	int                 done;
+	int                 result;
+	struct move_range   *dirty;
+	int                 ndirty;
+	pthread_cond_t      cond;
+	struct move_job     *next;
+	UT_hash_handle      hh;
+};
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static struct move_job *jobs = 0;
+static struct move_job *queue_head = 0, *queue_tail = 0;
+
+// count of jobs which collect dirty ranges
+static volatile int tracking = 0;
+
+static pthread_t *threads = 0;
+static int nthreads = 0;
+// mover_stop: the queued jobs fail, the copies stop
+static volatile int stopping = 0;
+
+// jobs_lock must be locked
+static void job_put(struct move_job * job)
+{
+	if (--job->refs)
+		return;
+	pthread_cond_destroy(&job->cond);
+	free(job->dirty);
+	free(job->name);
+	free(job);
+}
+
+// jobs_lock must be locked
+static void add_range(struct move_job * job, off_t start, off_t end)
+{
+	struct move_range *last;
+	int i;
+
+	if (!job->dirty)
+		job->dirty = calloc(MOVER_MAX_RANGES,
+			sizeof(struct move_range));
+
+	/* sequential writes extend the last range */
+	if (job->ndirty) {
+		last = job->dirty + job->ndirty - 1;
+		if (last->end != -1 && start >= last->start &&
+				start <= last->end) {
+			if (end == -1 || end > last->end)
+				last->end = end;
+			return;
+		}
+	}
+
+	if (job->ndirty < MOVER_MAX_RANGES) {
+		job->dirty[job->ndirty].start = start;
+		job->dirty[job->ndirty].end = end;
+		job->ndirty++;
+		return;
+	}
+
+	/* too many ranges: merge all of them into one */
+	last = job->dirty;
+	for (i = 1; i < job->ndirty; i++) {
+		if (job->dirty[i].start < last->start)
+			last->start = job->dirty[i].start;
+		if (last->end != -1 && (job->dirty[i].end == -1 ||
+				job->dirty[i].end > last->end))
+			last->end = job->dirty[i].end;
+	}
+	job->ndirty = 1;
+	add_range(job, start, end);
+}
+
+void mover_written(const char *name, off_t offset, off_t size)
+{
+	struct move_job *job;
+
+	if (!tracking)
+		return;
+
+	pthread_mutex_lock(&jobs_lock);
+	HASH_FIND_STR(jobs, name, job);
+	if (job && job->tracking)
+		add_range(job, offset, size < 0 ? -1 : offset + size);
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/* copy [start, end) from in to out */
+static int copy_range(int in, int out, off_t start, off_t end, char *buf)
+{
+	while (start < end) {
+		size_t count = mhdd.move_chunk;
+		ssize_t res;
+
+		if (end - start < count)
+			count = end - start;
+		res = pread(in, buf, count, start);
+		if (res == -1)
+			return -errno;
+		if (res == 0)
+			break;
+		if (pwrite(out, buf, res, start) != res)
+			return errno ? -errno : -ENOSPC;
+		start += res;
+	}
+	return 0;
+}
+
+/* flist is wrlocked: copy dirty ranges, switch opened files */
+static int finish_job(struct move_job * job, const char *from,
+	const char *to, char *tmp, int input, int output,
+	int src_id, int dir_id)
+{
+	struct stat st, cur;
+	struct move_range *dirty;
+	struct flist ** rlist;
+	struct timespec ftime[2];
+	int i, ndirty, ret = 0;
+	char *buf;
+
+	pthread_mutex_lock(&jobs_lock);
+	job->tracking = 0;
+	tracking--;
+	dirty = job->dirty;
+	ndirty = job->ndirty;
+	job->dirty = 0;
+	job->ndirty = 0;
+	pthread_mutex_unlock(&jobs_lock);
+
+	/* the file was removed or replaced meanwhile */
+	if (fstat(input, &st) != 0 ||
+			fstatat(mhdd.dir_fds[src_id], rel_path(job->name),
+				&cur, AT_SYMLINK_NOFOLLOW) != 0 ||
+			st.st_dev != cur.st_dev || st.st_ino != cur.st_ino) {
+		free(dirty);
+		return -ENOENT;
+	}
+
+	rlist = flist_items_by_name(job->name);
+	if (!rlist || strcmp(rlist[0]->real_name, from) != 0) {
+		free(rlist);
+		free(dirty);
+		return -ENOENT;
+	}
+
+	if (ndirty) {
+		mhdd_debug(MHDD_INFO, "mover: %s: %d dirty ranges\n",
+			job->name, ndirty);
+		buf = malloc(mhdd.move_chunk);
+		for (i = 0; i < ndirty && !ret; i++) {
+			off_t end = dirty[i].end;
+			if (end == -1 || end > st.st_size)
+				end = st.st_size;
+			ret = copy_range(input, output,
+				dirty[i].start, end, buf);
+		}
+		free(buf);
+	}
+	free(dirty);
+
+	if (!ret && ftruncate(output, st.st_size) != 0)
+		ret = -errno;
+	if (ret) {
+		mhdd_debug(MHDD_MSG, "mover: error copy dirty data to %s: %s\n",
+			to, strerror(-ret));
+		free(rlist);
+		return ret;
+	}
+
+	// owner/group/permissions
+	fchmod(output, st.st_mode);
+	fchown(output, st.st_uid, st.st_gid);
+
+	// time
+	ftime[0] = st.st_atim;
+	ftime[1] = st.st_mtim;
+	futimens(output, ftime);
+
+	if ((ret = move_tmp_link(dir_id, job->name, output, tmp)) != 0) {
+		mhdd_debug(MHDD_MSG, "mover: error link %s: %s\n",
+			to, strerror(-ret));
+		free(rlist);
+		return ret;
+	}
+
+#ifndef WITHOUT_XATTR
+	// extended attributes
+	if (copy_xattrs(from, to) == -1)
+		mhdd_debug(MHDD_MSG,
+			"copy_xattrs: error copying xattrs from %s to %s\n",
+			from, to);
+#endif
+
+	if ((ret = reopen_files(rlist[0], to, dir_id)) == 0) {
+		unlinkat(mhdd.dir_fds[src_id], rel_path(job->name), 0);
+		pcache_move(job->name, dir_id);
+		fspace_used(dir_id, st.st_size);
+		fspace_refresh(src_id);
+	} else {
+		unlinkat(mhdd.dir_fds[dir_id], rel_path(job->name), 0);
+	}
+	free(rlist);
+	return ret;
+}
+
+static int run_job(struct move_job * job)
+{
+	struct flist ** rlist;
+	struct statvfs svf;
+	struct stat st, ist;
+	struct timeval start, stop;
+	const char *method;
+	char *from, *to;
+	char tmp[PATH_MAX];
+	fsblkcnt_t space;
+	off_t size;
+	int input, output, dir_id, src_id, ret;
+	double elapsed;
+
+	/* get the file */
+	flist_rdlock();
+	rlist = flist_items_by_name(job->name);
+	if (!rlist) {
+		flist_unlock();
+		return -EBADF;
+	}
+	from = strdup(rlist[0]->real_name);
+	src_id = rlist[0]->dir_id;
+	ret = fstat(rlist[0]->fh, &st) == 0 ? 0 : -errno;
+	free(rlist);
+	flist_unlock();
+
+	mhdd_debug(MHDD_MSG, "mover: %s\n", from);
+
+	if (ret) {
+		mhdd_debug(MHDD_MSG, "mover: error stat %s: %s\n",
+			from, strerror(-ret));
+		free(from);
+		return ret;
+	}
+
+	/* see move_file */
+	if (st.st_nlink > 1) {
+		mhdd_debug(MHDD_MSG, "mover: cannot move "
+			"files with >1 hardlinks\n");
+		free(from);
+		return -ENOTSUP;
+	}
+
+	/* We need to check if already moved */
+	if (fstatvfs(mhdd.dir_fds[src_id], &svf) != 0) {
+		ret = -errno;
+		free(from);
+		return ret;
+	}
+	space = svf.f_bsize;
+	space *= svf.f_bavail;
+
+	size = st.st_size;
+	if (size < job->wsize) size = job->wsize;
+
+	if (space > size) {
+		mhdd_debug(MHDD_MSG, "mover: we have enough space\n");
+		free(from);
+		return 0;
+	}
+
+	if ((dir_id = find_free_space(size)) == -1) {
+		mhdd_debug(MHDD_MSG, "mover: can not find space\n");
+		free(from);
+		return -ENOSPC;
+	}
+
+	input = openat(mhdd.dir_fds[src_id], rel_path(job->name), O_RDONLY);
+	if (input == -1) {
+		ret = -errno;
+		free(from);
+		return ret;
+	}
+
+	/* the file was replaced after fstat */
+	if (fstat(input, &ist) != 0 || ist.st_ino != st.st_ino ||
+			ist.st_dev != st.st_dev) {
+		close(input);
+		free(from);
+		return -ENOENT;
+	}
+
+	create_parent_dirs(dir_id, job->name);
+	to = create_path(mhdd.dirs[dir_id], job->name);
+	output = move_tmp_open(dir_id, job->name, tmp);
+	if (output == -1) {
+		ret = -errno;
+		mhdd_debug(MHDD_MSG, "mover: error create %s: %s\n",
+			to, strerror(errno));
+		close(input);
+		free(from);
+		free(to);
+		return ret;
+	}
+
+	mhdd_debug(MHDD_MSG, "mover: move %s to %s\n", from, to);
+	stats_dir(src_id, STATS_MOVES_STARTED, 1);
+
+	/* writes that are done before it are already in the file */
+	flist_wrlock();
+	pthread_mutex_lock(&jobs_lock);
+	job->tracking = 1;
+	tracking++;
+	pthread_mutex_unlock(&jobs_lock);
+	flist_unlock();
+
+	// move data
+	gettimeofday(&start, 0);
+	policy_io_start(dir_id);
+	size = copy_data(input, output, &method, (const int *)&stopping);
+	policy_io_end(dir_id);
+	gettimeofday(&stop, 0);
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_usec - start.tv_usec) / 1000000.0;
+
+	if (size < 0) {
+		mhdd_debug(MHDD_MSG, "mover: error move data to %s: %s\n",
+			to, strerror(-size));
+	} else {
+		mhdd_debug(MHDD_MSG, "mover: done move data, %lld bytes "
+			"in %.2fs (%.1f MB/s, %s)\n",
+			(long long)size, elapsed,
+			elapsed > 0 ? size / elapsed / (1024 * 1024) : 0.0,
+			method);
+	}
+
+	flist_wrlock();
+	if (size < 0) {
+		pthread_mutex_lock(&jobs_lock);
+		job->tracking = 0;
+		tracking--;
+		pthread_mutex_unlock(&jobs_lock);
+		ret = -EIO;
+	} else {
+		ret = finish_job(job, from, to, tmp, input, output,
+			src_id, dir_id);
+	}
+	close(input);
+	close(output);
+	move_tmp_drop(dir_id, tmp);
+	flist_unlock();
+
+	if (ret) {
+		stats_dir(src_id, STATS_MOVES_FAILED, 1);
+	} else {
+		stats_dir(src_id, STATS_MOVES_DONE, 1);
+		stats_dir(src_id, STATS_BYTES_MOVED, size);
+	}
+
+	mhdd_debug(MHDD_MSG, "mover: %s -> %s: done, code=%d\n",
+		from, to, ret);
+	free(from);
+	free(to);
+	return ret;
+}
+
+static void * mover_thread(void * arg)
+{
+	struct move_job * job;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs_lock);
+		while (!queue_head && !stopping)
+			pthread_cond_wait(&jobs_cond, &jobs_lock);
+		if (stopping) {
+			pthread_mutex_unlock(&jobs_lock);
+			break;
+		}
+		job = queue_head;
+		queue_head = job->next;
+		if (!queue_head)
+			queue_tail = 0;
+		pthread_mutex_unlock(&jobs_lock);
+
+		ret = run_job(job);
+
+		pthread_mutex_lock(&jobs_lock);
+		HASH_DEL(jobs, job);
+		job->done = 1;
+		job->result = ret;
+		pthread_cond_broadcast(&job->cond);
+		job_put(job);
+		pthread_mutex_unlock(&jobs_lock);
+	}
+	return 0;
+}
+
+void mover_init(int count)
+{
+	int i;
+
+	if (count > 0)
+		threads = calloc(count, sizeof(pthread_t));
+	for (i = 0; i < count; i++) {
+		if (pthread_create(threads + i, 0, mover_thread, 0) != 0) {
+			mhdd_debug(MHDD_MSG, "mover_init: can not start "
+				"thread: %s\n", strerror(errno));
+			break;
+		}
+	}
+	nthreads = i;
+	mhdd_debug(MHDD_INFO, "mover_init: %d threads\n", i);
+}
+
+void mover_stop(void)
+{
+	struct move_job *job;
+	int i;
+
+	pthread_mutex_lock(&jobs_lock);
+	stopping = 1;
+	while ((job = queue_head)) {
+		queue_head = job->next;
+		HASH_DEL(jobs, job);
+		job->done = 1;
+		job->result = -ECANCELED;
+		pthread_cond_broadcast(&job->cond);
+		job_put(job);
+	}
+	queue_tail = 0;
+	pthread_cond_broadcast(&jobs_cond);
+	pthread_mutex_unlock(&jobs_lock);
+
+	/* a running copy fails at the next chunk and is dropped */
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], 0);
+	free(threads);
+	threads = 0;
+	nthreads = 0;
+}
+
+int mover_move(struct flist * file, off_t wsize)
+{
+	struct move_job * job;
+	struct timeval now;
+	struct timespec deadline;
+	int ret = 0;
+
+	pthread_mutex_lock(&jobs_lock);
+	if (stopping) {
+		pthread_mutex_unlock(&jobs_lock);
+		flist_unlock();
+		return -ECANCELED;
+	}
+	HASH_FIND_STR(jobs, file->name, job);
+	if (!job) {
+		job = calloc(1, sizeof(struct move_job));
+		job->name = strdup(file->name);
+		job->wsize = wsize;
+		job->refs = 1;
+		pthread_cond_init(&job->cond, 0);
+		HASH_ADD_KEYPTR(hh, jobs, job->name, strlen(job->name), job);
+
+		if (queue_tail)
+			queue_tail->next = job;
+		else
+			queue_head = job;
+		queue_tail = job;
+		pthread_cond_signal(&jobs_cond);
+	} else if (job->wsize < wsize) {
+		job->wsize = wsize;
+	}
+	job->refs++;
+	pthread_mutex_unlock(&jobs_lock);
+	flist_unlock();
+
+	mhdd_debug(MHDD_INFO, "mover_move: wait for %s\n", job->name);
+
+	gettimeofday(&now, 0);
+	deadline.tv_sec = now.tv_sec + mhdd.move_timeout;
+	deadline.tv_nsec = now.tv_usec * 1000;
+
+	pthread_mutex_lock(&jobs_lock);
+	while (!job->done && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&job->cond, &jobs_lock, &deadline);
+	if (job->done) {
+		ret = job->result;
+	} else {
+		mhdd_debug(MHDD_MSG, "mover_move: timeout for %s\n",
+			job->name);
+		ret = -ETIMEDOUT;
+	}
+	job_put(job);
+	pthread_mutex_unlock(&jobs_lock);
+	return ret;
+}
@@ -0,0 +1,44 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MOVER__H__
+#define __MOVER__H__
+
+#include <sys/types.h>
+
+#include "flist.h"
+
+// background file moving (migration to another disk)
+
+#define MOVER_DEFAULT_THREADS   0
+#define MOVER_DEFAULT_TIMEOUT   300
+
+// start mover threads
+void mover_init(int threads);
+
+// fail the queued moves, stop the running ones and the threads
+void mover_stop(void);
+
+// move file in background and wait for result (up to mhdd.move_timeout)
+// file must be rdlocked, the list is unlocked on return
+int mover_move(struct flist * file, off_t wsize);
+
+// file was changed in [offset, offset+size) (size < 0 - till the end)
+// must be called under flist lock
+void mover_written(const char *name, off_t offset, off_t size);
+
+#endif
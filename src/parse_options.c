@@ -33,11 +33,21 @@
 #include "version.h"
 #include "debug.h"
 #include "tools.h"
+#include "pcache.h"
+#include "mover.h"
+#include "fspace.h"
+#include "tpool.h"
+#include "uring.h"
+#include "policy.h"
+#include "pindex.h"
+#include "warmup.h"
 
 struct mhdd_config mhdd={0};
 
 #define MHDDFS_OPT(t, p, v) { t, offsetof(struct mhdd_config, p), v }
 #define MHDD_VERSION_OPT 15121974
+#define MHDD_KERNEL_CACHE_OPT 1
+#define MHDD_AUTO_CACHE_OPT 2
 
 
 #if FUSE_VERSION >= 27
@@ -55,7 +65,25 @@ static struct fuse_opt mhddfs_opts[]={
 	MHDDFS_OPT("mlimit=%s",   mlimit_str, 0),
 	MHDDFS_OPT("logfile=%s",  debug_file, 0),
 	MHDDFS_OPT("loglevel=%d", loglevel,   0),
-
+	MHDDFS_OPT("cache_size=%d", cache_size, 0),
+	MHDDFS_OPT("move_chunk=%s", move_chunk_str, 0),
+	MHDDFS_OPT("move_threads=%d", move_threads, 0),
+	MHDDFS_OPT("move_timeout=%d", move_timeout, 0),
+	MHDDFS_OPT("space_refresh=%d", space_refresh, 0),
+	MHDDFS_OPT("lowlevel", lowlevel, 1),
+	MHDDFS_OPT("scan_threads=%d", scan_threads, 0),
+	MHDDFS_OPT("parallel_lookup", parallel_lookup, 1),
+	MHDDFS_OPT("uring_depth=%d", uring_depth, 0),
+	MHDDFS_OPT("placement=%s", placement_str, 0),
+	MHDDFS_OPT("affinity=%d", affinity, 0),
+	MHDDFS_OPT("index=%s", index_file, 0),
+	MHDDFS_OPT("index_size=%d", index_size, 0),
+	MHDDFS_OPT("warmup", warmup, 1),
+	MHDDFS_OPT("warmup_rate=%d", warmup_rate, 0),
+	MHDDFS_OPT("watch", watch, 1),
+
+	FUSE_OPT_KEY("kernel_cache", MHDD_KERNEL_CACHE_OPT),
+	FUSE_OPT_KEY("auto_cache", MHDD_AUTO_CACHE_OPT),
 	FUSE_OPT_KEY("-V",        MHDD_VERSION_OPT),
 	FUSE_OPT_KEY("--version", MHDD_VERSION_OPT),
 
@@ -107,6 +135,14 @@ static int mhddfs_opt_proc(void *data,
 			fprintf(stderr, "mhddfs version: %s\n", VERSION);
 			exit(0);
 
+		/* kept for libfuse, lowlevel_main drops them */
+		case MHDD_KERNEL_CACHE_OPT:
+			mhdd.kernel_cache = 1;
+			return 1;
+		case MHDD_AUTO_CACHE_OPT:
+			mhdd.auto_cache = 1;
+			return 1;
+
 		case FUSE_OPT_KEY_NONOPT:
 			{
 				char *dir = strdup(arg);
@@ -172,6 +208,51 @@ static void check_if_unique_mountpoints(void)
 	free(stats);
 }
 
+/* size with optional [kKmMgG%] suffix, -1 for % if it is not a limit */
+static off_t parse_size(char *str, int percent)
+{
+	int len = strlen(str);
+	off_t size;
+
+	if (!len)
+		return 0;
+
+	switch(str[len-1])
+	{
+		case 'm':
+		case 'M':
+			str[len-1]=0;
+			size=atoll(str);
+			size*=1024*1024;
+			break;
+		case 'g':
+		case 'G':
+			str[len-1]=0;
+			size=atoll(str);
+			size*=1024*1024*1024;
+			break;
+
+		case 'k':
+		case 'K':
+			str[len-1]=0;
+			size=atoll(str);
+			size*=1024;
+			break;
+
+		case '%':
+			if (!percent)
+				return -1;
+			str[len-1]=0;
+			size=atoll(str);
+			break;
+
+		default:
+			size=atoll(str);
+			break;
+	}
+	return size;
+}
+
 struct fuse_args * parse_options(int argc, char *argv[])
 {
 	struct fuse_args * args=calloc(1, sizeof(struct fuse_args));
@@ -184,10 +265,27 @@ struct fuse_args * parse_options(int argc, char *argv[])
 	}
 
 	mhdd.loglevel=MHDD_DEFAULT_DEBUG_LEVEL;
+	mhdd.cache_size=-1;
+	mhdd.move_threads=MOVER_DEFAULT_THREADS;
+	mhdd.move_timeout=MOVER_DEFAULT_TIMEOUT;
+	mhdd.space_refresh=FSPACE_DEFAULT_INTERVAL;
+	mhdd.scan_threads=TPOOL_DEFAULT_THREADS;
+	mhdd.uring_depth=URING_DEFAULT_DEPTH;
+	mhdd.index_size=PINDEX_DEFAULT_SIZE;
+	mhdd.warmup_rate=WARMUP_DEFAULT_RATE;
 	if (fuse_opt_parse(args, &mhdd, mhddfs_opts, mhddfs_opt_proc)==-1)
 		usage(stderr);
 
 	if (mhdd.cdirs<3) usage(stderr);
+
+	/* the cached locations are only kept right with watch */
+	if (mhdd.cache_size < 0)
+		mhdd.cache_size = mhdd.watch ? PCACHE_DEFAULT_SIZE : 0;
+
+	/* the page cache options are libfuse's in the path based
+	   interface, the low-level one does not know them */
+	if (mhdd.lowlevel)
+		mhdd.keep_cache = mhdd.kernel_cache || mhdd.auto_cache;
 	mhdd.mount=mhdd.dirs[--mhdd.cdirs];
 	mhdd.dirs[mhdd.cdirs]=0;
 
@@ -209,10 +307,14 @@ struct fuse_args * parse_options(int argc, char *argv[])
 	if (mhdd.cdirs)
 	{
 		int i;
+		mhdd.dir_fds=calloc(mhdd.cdirs, sizeof(int));
 		for(i=0; i<mhdd.cdirs; i++)
 		{
 			struct stat info;
-			if (stat(mhdd.dirs[i], &info))
+			/* the dirs are used through the fds, even if
+			   something gets mounted over them later */
+			if ((mhdd.dir_fds[i]=open_dir(mhdd.dirs[i]))==-1 ||
+				fstat(mhdd.dir_fds[i], &info))
 			{
 				fprintf(stderr,
 					"mhddfs: can not stat '%s': %s\n",
@@ -254,41 +356,8 @@ struct fuse_args * parse_options(int argc, char *argv[])
 
 	if (mhdd.mlimit_str)
 	{
-		int len = strlen(mhdd.mlimit_str);
-
-		if (len) {
-			switch(mhdd.mlimit_str[len-1])
-			{
-				case 'm':
-				case 'M':
-					mhdd.mlimit_str[len-1]=0;
-					mhdd.move_limit=atoll(mhdd.mlimit_str);
-					mhdd.move_limit*=1024*1024;
-					break;
-				case 'g':
-				case 'G':
-					mhdd.mlimit_str[len-1]=0;
-					mhdd.move_limit=atoll(mhdd.mlimit_str);
-					mhdd.move_limit*=1024*1024*1024;
-					break;
-
-				case 'k':
-				case 'K':
-					mhdd.mlimit_str[len-1]=0;
-					mhdd.move_limit=atoll(mhdd.mlimit_str);
-					mhdd.move_limit*=1024;
-					break;
-
-				case '%':
-					mhdd.mlimit_str[len-1]=0;
-					mhdd.move_limit=atoll(mhdd.mlimit_str);
-					break;
-
-				default:
-					mhdd.move_limit=atoll(mhdd.mlimit_str);
-					break;
-			}
-		}
+		if (strlen(mhdd.mlimit_str))
+			mhdd.move_limit = parse_size(mhdd.mlimit_str, 1);
 
 		if (mhdd.move_limit < MINIMUM_MLIMIT) {
 			if (!mhdd.move_limit) {
@@ -306,6 +375,49 @@ struct fuse_args * parse_options(int argc, char *argv[])
 		fprintf(stderr, "mhddfs: move size limit %lld bytes\n",
 				(long long)mhdd.move_limit);
 
+	mhdd.move_chunk = MOVE_BLOCK_SIZE;
+	if (mhdd.move_chunk_str) {
+		mhdd.move_chunk = parse_size(mhdd.move_chunk_str, 0);
+		if (mhdd.move_chunk < 0) {
+			fprintf(stderr, "mhddfs: move_chunk '%s' is not a size\n",
+					mhdd.move_chunk_str);
+			exit(-1);
+		}
+		if (mhdd.move_chunk < MOVE_BUF_ALIGN)
+			mhdd.move_chunk = MOVE_BUF_ALIGN;
+		mhdd.move_chunk -= mhdd.move_chunk % MOVE_BUF_ALIGN;
+	}
+	fprintf(stderr, "mhddfs: move chunk size %lld bytes\n",
+			(long long)mhdd.move_chunk);
+	if (mhdd.move_threads < 0)
+		mhdd.move_threads = 0;
+	if (mhdd.move_timeout <= 0)
+		mhdd.move_timeout = MOVER_DEFAULT_TIMEOUT;
+
+	if (mhdd.placement_str) {
+		mhdd.placement = policy_parse(mhdd.placement_str);
+		if (mhdd.placement < 0) {
+			fprintf(stderr, "mhddfs: unknown placement '%s'\n",
+					mhdd.placement_str);
+			exit(-1);
+		}
+	}
+	fprintf(stderr, "mhddfs: placement %s\n",
+			policy_name(mhdd.placement));
+	if (mhdd.affinity < 0)
+		mhdd.affinity = 0;
+	if (mhdd.affinity)
+		fprintf(stderr, "mhddfs: affinity depth %d\n", mhdd.affinity);
+
+	/* the daemon works in / */
+	if (mhdd.index_file && *mhdd.index_file != '/') {
+		char cpwd[PATH_MAX];
+		getcwd(cpwd, PATH_MAX);
+		mhdd.index_file = create_path(cpwd, mhdd.index_file);
+	}
+	if (mhdd.index_file)
+		fprintf(stderr, "mhddfs: location index %s\n", mhdd.index_file);
+
 	mhdd_debug(MHDD_MSG, " >>>>> mhdd " VERSION " started <<<<<\n");
 
 	return args;
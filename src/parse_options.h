@@ -27,6 +27,7 @@ struct mhdd_config
 {
 	char *  mount;    // mount point
 	char ** dirs;     // dir list
+	int  *  dir_fds;  // O_PATH fds of the dirs (open at mount)
 
 	int  cdirs;       // count dirs in dirs
 
@@ -38,6 +39,38 @@ struct mhdd_config
 	char  *mlimit_str;  // mlimit string
 
 	int   loglevel;
+
+	int   cache_size;   // path cache entries (0 - disabled)
+
+	off_t move_chunk;       // bytes per copy call while moving
+	char  *move_chunk_str;
+	int   move_threads;     // background movers (0 - move in write)
+	int   move_timeout;     // seconds to wait for the mover
+
+	int   space_refresh;    // seconds between statvfs (0 - every call)
+
+	int   lowlevel;         // inode based fuse backend
+	int   kernel_cache;     // libfuse's kernel_cache and auto_cache,
+	int   auto_cache;       // done by mhddfs in the low-level backend
+	int   keep_cache;       // opens set keep_cache (low-level only)
+
+	int   scan_threads;     // threads reading the dirs in parallel
+	int   parallel_lookup;  // probe all the dirs at once
+
+	int   uring_depth;      // io_uring queue depth (0 - plain syscalls)
+
+	char  *placement_str;
+	int   placement;        // policy for new files and dirs
+	int   affinity;         // keep new entries near their parent
+				// (depth of the shared ancestor, 0 - off)
+
+	char  *index_file;      // persistent location index (0 - off)
+	int   index_size;       // slots of the index
+
+	int   warmup;           // crawl the dirs after mount
+	int   warmup_rate;      // entries per second of a crawler (0 - any)
+
+	int   watch;            // follow the changes made behind mhddfs
 };
 
 extern struct mhdd_config mhdd;
@@ -0,0 +1,288 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <uthash.h>
+
+#include "pcache.h"
+#include "pindex.h"
+#include "debug.h"
+
+/* the cache is split into shards to keep lock contention low,
+   each shard is an uthash table in LRU order (head is the oldest) */
+#define PCACHE_SHARDS 32
+
+struct pcache_item
+{
+	int             dir_id;
+	unsigned        gen;
+	int             warm;       // offered by the warmup
+	UT_hash_handle  hh;
+	char            path[];
+};
+
+struct pcache_shard
+{
+	pthread_mutex_t     lock;
+	struct pcache_item  *items;
+	unsigned            count;
+};
+
+static struct pcache_shard shards[PCACHE_SHARDS];
+static unsigned shard_limit = 0;
+static unsigned generation = 0;     // atomic
+static int warm_max = -1;       // the warm items up to this dir are right
+
+static unsigned long long hits = 0, misses = 0, evictions = 0;
+
+void pcache_init(int size)
+{
+	int i;
+
+	for (i = 0; i < PCACHE_SHARDS; i++)
+		pthread_mutex_init(&shards[i].lock, 0);
+
+	if (size <= 0) {
+		shard_limit = 0;
+		mhdd_debug(MHDD_MSG, "pcache_init: cache disabled\n");
+		return;
+	}
+
+	shard_limit = (size + PCACHE_SHARDS - 1) / PCACHE_SHARDS;
+	mhdd_debug(MHDD_MSG, "pcache_init: %d entries\n", size);
+}
+
+static struct pcache_shard * shard_by_path(const char *path, size_t len)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+	return shards + h % PCACHE_SHARDS;
+}
+
+static void delete_item(struct pcache_shard *shard, struct pcache_item *item)
+{
+	HASH_DEL(shard->items, item);
+	shard->count--;
+	free(item);
+}
+
+static void cache_set(const char *path, int dir_id, int warm, unsigned gen);
+
+int pcache_get(const char *path)
+{
+	struct pcache_shard *shard;
+	struct pcache_item *item;
+	size_t len;
+	int dir_id = -1;
+
+	if (!shard_limit)
+		return pindex_get(path);
+
+	len = strlen(path);
+	shard = shard_by_path(path, len);
+
+	pthread_mutex_lock(&shard->lock);
+	HASH_FIND(hh, shard->items, path, len, item);
+	if (item) {
+		if (item->gen != __atomic_load_n(&generation,
+				__ATOMIC_ACQUIRE)) {
+			delete_item(shard, item);
+		} else if (item->warm && item->dir_id >
+				__atomic_load_n(&warm_max, __ATOMIC_RELAXED)) {
+			/* an earlier dir may still have it */
+		} else {
+			dir_id = item->dir_id;
+			/* move to the tail of LRU list */
+			HASH_DEL(shard->items, item);
+			HASH_ADD_KEYPTR(hh, shard->items, item->path, len, item);
+		}
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (dir_id != -1) {
+		__sync_fetch_and_add(&hits, 1);
+		return dir_id;
+	}
+	__sync_fetch_and_add(&misses, 1);
+
+	/* the persistent index remembers the paths of the last mounts */
+	if ((dir_id = pindex_get(path)) != -1)
+		cache_set(path, dir_id, 0, pcache_generation());
+	return dir_id;
+}
+
+// gen is the generation the caller found dir_id at
+static void cache_set(const char *path, int dir_id, int warm, unsigned gen)
+{
+	struct pcache_shard *shard;
+	struct pcache_item *item;
+	size_t len;
+
+	if (!shard_limit)
+		return;
+
+	len = strlen(path);
+	shard = shard_by_path(path, len);
+
+	pthread_mutex_lock(&shard->lock);
+	/* flushed after the caller looked: what it found may be stale,
+	   a flush after this check leaves the item with the old gen */
+	if (gen != __atomic_load_n(&generation, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&shard->lock);
+		return;
+	}
+	HASH_FIND(hh, shard->items, path, len, item);
+	if (item) {
+		/* the warmup does not override the lookups or earlier dirs */
+		if (!warm || (item->warm && (item->gen != gen ||
+				dir_id < item->dir_id))) {
+			item->dir_id = dir_id;
+			item->gen = gen;
+			item->warm = warm;
+		}
+		pthread_mutex_unlock(&shard->lock);
+		return;
+	}
+
+	if (shard->count >= shard_limit) {
+		/* evict the least recently used item */
+		delete_item(shard, shard->items);
+		__sync_fetch_and_add(&evictions, 1);
+	}
+
+	item = malloc(sizeof(struct pcache_item) + len + 1);
+	if (item) {
+		memcpy(item->path, path, len + 1);
+		item->dir_id = dir_id;
+		item->gen = gen;
+		item->warm = warm;
+		HASH_ADD_KEYPTR(hh, shard->items, item->path, len, item);
+		shard->count++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void pcache_set(const char *path, int dir_id)
+{
+	cache_set(path, dir_id, 0, pcache_generation());
+	pindex_set(path, dir_id);
+}
+
+unsigned pcache_generation(void)
+{
+	return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+void pcache_found(const char *path, int dir_id, unsigned gen)
+{
+	if (gen != pcache_generation())
+		return;
+	cache_set(path, dir_id, 0, gen);
+	pindex_found(path, dir_id, gen);
+}
+
+void pcache_move(const char *path, int dir_id)
+{
+	cache_set(path, dir_id, 0, pcache_generation());
+	pindex_move(path, dir_id);
+}
+
+void pcache_offer(const char *path, int dir_id)
+{
+	cache_set(path, dir_id, 1, pcache_generation());
+}
+
+void pcache_offer_done(int max_dir)
+{
+	__atomic_store_n(&warm_max, max_dir, __ATOMIC_RELAXED);
+}
+
+void pcache_forget(const char *path)
+{
+	struct pcache_shard *shard;
+	struct pcache_item *item;
+	size_t len;
+
+	pindex_forget(path);
+	if (!shard_limit)
+		return;
+
+	len = strlen(path);
+	shard = shard_by_path(path, len);
+
+	pthread_mutex_lock(&shard->lock);
+	HASH_FIND(hh, shard->items, path, len, item);
+	if (item)
+		delete_item(shard, item);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void pcache_changed(const char *path, int dir_id, int gone)
+{
+	struct pcache_shard *shard;
+	struct pcache_item *item;
+	size_t len;
+
+	if (gone)
+		pindex_unset(path, dir_id);
+	else
+		pindex_set(path, dir_id);
+	if (!shard_limit)
+		return;
+
+	len = strlen(path);
+	shard = shard_by_path(path, len);
+
+	/* the cached dir stays right unless it lost the path
+	   or an earlier dir got it */
+	pthread_mutex_lock(&shard->lock);
+	HASH_FIND(hh, shard->items, path, len, item);
+	if (item && (gone ? item->dir_id == dir_id : dir_id < item->dir_id))
+		delete_item(shard, item);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/* items with old generation are dropped lazily by pcache_get,
+   the slots of the index by pindex_get */
+void pcache_flush(void)
+{
+	unsigned gen = __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+	pindex_flush(gen);
+	mhdd_debug(MHDD_DEBUG, "pcache_flush: generation %u\n", gen);
+}
+
+void pcache_get_stats(struct pcache_stats *stats)
+{
+	int i;
+
+	stats->hits = hits;
+	stats->misses = misses;
+	stats->evictions = evictions;
+	stats->entries = 0;
+	for (i = 0; i < PCACHE_SHARDS; i++)
+		stats->entries += shards[i].count;
+}
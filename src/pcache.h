@@ -0,0 +1,71 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PCACHE__H__
+#define __PCACHE__H__
+
+// path -> dir_id cache (LRU, bounded by mhdd.cache_size entries)
+// backed by the persistent index (pindex.h) if it is on
+
+// the default with -o watch; without it the cache is off unless
+// cache_size is given, as it would hide changes made behind mhddfs
+#define PCACHE_DEFAULT_SIZE 262144
+
+struct pcache_stats
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long entries;
+};
+
+void pcache_init(int size);
+
+// dir_id of the path or -1 if unknown
+int pcache_get(const char *path);
+
+// remember that path lives on dir_id
+void pcache_set(const char *path, int dir_id);
+
+// taken before a lookup of the dirs, for pcache_found
+unsigned pcache_generation(void);
+
+// the lookup started at gen found path on dir_id, dropped if the
+// cache was flushed meanwhile
+void pcache_found(const char *path, int dir_id, unsigned gen);
+
+// path was moved to dir_id (it is not on the other dirs)
+void pcache_move(const char *path, int dir_id);
+
+// path found on dir_id by the warmup, kept unless known or on an earlier dir
+void pcache_offer(const char *path, int dir_id);
+
+// the offers of the dirs up to max_dir are complete and can be used
+void pcache_offer_done(int max_dir);
+
+// forget one path
+void pcache_forget(const char *path);
+
+// path was created (gone - removed) on dir_id behind mhddfs
+void pcache_changed(const char *path, int dir_id, int gone);
+
+// forget all paths (directory renames etc)
+void pcache_flush(void);
+
+void pcache_get_stats(struct pcache_stats *stats);
+
+#endif
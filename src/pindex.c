@@ -0,0 +1,400 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+
+#include "pindex.h"
+#include "debug.h"
+#include "parse_options.h"
+
+/*
+   The file is a header and an open addressing hash table of
+   (path hash, generation and bitmap of the dirs).  The slots are changed
+   with atomics by any thread, a slot once taken by a hash keeps it (a
+   forgotten path has an empty bitmap).  The index only says where to look
+   first: every hit is checked with lstat by find_path_dir.
+
+   A directory rename (or a watch overflow) changes paths that can not be
+   listed, pindex_flush bumps the generation of the header instead and
+   the slots of an older generation are unknown.  A lookup refreshes a
+   slot with the first dir only (partial): the other dirs having the path
+   are not known, so losing that dir makes the slot unknown again.
+
+   A clean unmount writes a marker of every dir (device, inode, inodes
+   in use).  At mount an index without them, or with markers that differ
+   (the dirs were changed without mhddfs), is emptied and the dirs are
+   crawled in background by the warmup (warmup.c).
+*/
+
+#define PINDEX_MAGIC    "MHDDIDX"
+#define PINDEX_VERSION  2
+#define PINDEX_HEAD     4096
+#define PINDEX_PROBES   64
+
+struct pindex_mark
+{
+	uint64_t    dev;
+	uint64_t    ino;
+	uint64_t    inodes;     // in use on the filesystem
+	uint64_t    name;       // hash of the dir path
+};
+
+struct pindex_head
+{
+	char                magic[8];
+	uint32_t            version;
+	uint32_t            dirs;
+	uint64_t            slots;
+	uint64_t            used;       // slots taken, atomic
+	uint32_t            clean;      // unmounted properly
+	uint32_t            complete;   // all the dirs are crawled
+	uint32_t            generation; // slots of other ones are stale
+	struct pindex_mark  marks[PINDEX_MAX_DIRS];
+};
+
+struct pindex_slot
+{
+	uint64_t    hash;
+	uint64_t    dirs;       // generation, partial flag, bitmap
+};
+
+#define SLOT_DIRS       0xffffffffULL
+#define SLOT_PARTIAL    (1ULL << 32)
+#define SLOT_GEN_SHIFT  33
+#define SLOT_GEN_MASK   0x7fffffffU
+
+static struct pindex_head *head = 0;
+static struct pindex_slot *slots = 0;
+static uint64_t mask = 0;
+static size_t map_size = 0;
+static int fd = -1;
+static uint32_t gen_base = 0;   // generation of the index at mount
+
+static int full = 0;
+static unsigned long long hits = 0;
+
+static uint64_t path_hash(const char *path)
+{
+	/* FNV-1a, 0 is the empty slot */
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *path; path++) {
+		h ^= (unsigned char)*path;
+		h *= 1099511628211ULL;
+	}
+	return h ? h : 1;
+}
+
+static struct pindex_slot * find_slot(const char *path, int create)
+{
+	uint64_t h = path_hash(path), cur;
+	struct pindex_slot *slot;
+	int i;
+
+	for (i = 0; i < PINDEX_PROBES; i++) {
+		slot = slots + ((h + i) & mask);
+		cur = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+		if (cur == h)
+			return slot;
+		if (cur)
+			continue;
+		if (!create)
+			return 0;
+
+		if (__atomic_load_n(&head->used, __ATOMIC_RELAXED) >=
+				head->slots / 4 * 3) {
+			if (!__sync_lock_test_and_set(&full, 1))
+				mhdd_debug(MHDD_MSG, "pindex: the index is "
+					"full, increase index_size\n");
+			return 0;
+		}
+		if (__sync_bool_compare_and_swap(&slot->hash, 0, h)) {
+			__sync_fetch_and_add(&head->used, 1);
+			return slot;
+		}
+		if (__atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE) == h)
+			return slot;
+	}
+	return 0;
+}
+
+static uint64_t slot_gen(uint32_t gen)
+{
+	return (uint64_t)(gen & SLOT_GEN_MASK) << SLOT_GEN_SHIFT;
+}
+
+static uint64_t current_gen(void)
+{
+	return slot_gen(__atomic_load_n(&head->generation, __ATOMIC_ACQUIRE));
+}
+
+int pindex_complete(void)
+{
+	return !head || __atomic_load_n(&head->complete, __ATOMIC_RELAXED);
+}
+
+int pindex_get(const char *path)
+{
+	struct pindex_slot *slot;
+	uint64_t dirs;
+	int i;
+
+	/* while it is built a later dir may be known before the first */
+	if (!head || !__atomic_load_n(&head->complete, __ATOMIC_RELAXED) ||
+			!(slot = find_slot(path, 0)))
+		return -1;
+	dirs = __atomic_load_n(&slot->dirs, __ATOMIC_RELAXED);
+	if ((dirs & ~(SLOT_DIRS | SLOT_PARTIAL)) != current_gen() ||
+			!(dirs & SLOT_DIRS))
+		return -1;
+	i = __builtin_ctzll(dirs);
+	if (i >= mhdd.cdirs)
+		return -1;
+	__sync_fetch_and_add(&hits, 1);
+	return i;
+}
+
+void pindex_set(const char *path, int dir_id)
+{
+	struct pindex_slot *slot;
+
+	if (!head || dir_id < 0 || !(slot = find_slot(path, 1)))
+		return;
+	/* a stale slot stays stale, its other dirs are not known */
+	__sync_fetch_and_or(&slot->dirs, 1ULL << dir_id);
+}
+
+void pindex_found(const char *path, int dir_id, unsigned gen)
+{
+	struct pindex_slot *slot;
+	uint64_t cur, val, g = slot_gen(gen_base + gen);
+
+	if (!head || dir_id < 0 || !(slot = find_slot(path, 1)))
+		return;
+	/* flushed since the lookup: g is stale and so is the slot */
+	do {
+		cur = __atomic_load_n(&slot->dirs, __ATOMIC_RELAXED);
+		if ((cur & ~(SLOT_DIRS | SLOT_PARTIAL)) == g)
+			val = cur | (1ULL << dir_id);
+		else
+			val = g | SLOT_PARTIAL | (1ULL << dir_id);
+	} while (!__sync_bool_compare_and_swap(&slot->dirs, cur, val));
+}
+
+void pindex_move(const char *path, int dir_id)
+{
+	struct pindex_slot *slot;
+
+	if (!head || dir_id < 0 || !(slot = find_slot(path, 1)))
+		return;
+	__atomic_store_n(&slot->dirs, current_gen() | 1ULL << dir_id,
+		__ATOMIC_RELAXED);
+}
+
+void pindex_unset(const char *path, int dir_id)
+{
+	struct pindex_slot *slot;
+
+	uint64_t cur, val, bit = 1ULL << dir_id;
+
+	if (!head || dir_id < 0 || !(slot = find_slot(path, 0)))
+		return;
+	do {
+		cur = __atomic_load_n(&slot->dirs, __ATOMIC_RELAXED);
+		val = cur & ~bit;
+		/* the next dir of a partial slot is not known,
+		   another generation makes it stale */
+		if ((cur & SLOT_PARTIAL) && (cur & SLOT_DIRS & -cur) == bit)
+			val = current_gen() ^ (1ULL << SLOT_GEN_SHIFT);
+	} while (!__sync_bool_compare_and_swap(&slot->dirs, cur, val));
+}
+
+void pindex_forget(const char *path)
+{
+	struct pindex_slot *slot;
+
+	if (!head || !(slot = find_slot(path, 0)))
+		return;
+	__atomic_store_n(&slot->dirs, current_gen(), __ATOMIC_RELAXED);
+}
+
+void pindex_flush(unsigned gen)
+{
+	if (!head)
+		return;
+	__atomic_store_n(&head->generation, (gen_base + gen) & SLOT_GEN_MASK,
+		__ATOMIC_RELEASE);
+}
+
+static void mark_dir(int dir_id, struct pindex_mark *mark)
+{
+	struct stat st;
+	struct statvfs stv;
+
+	memset(mark, 0, sizeof(struct pindex_mark));
+	mark->name = path_hash(mhdd.dirs[dir_id]);
+	if (fstat(mhdd.dir_fds[dir_id], &st) == 0) {
+		mark->dev = st.st_dev;
+		mark->ino = st.st_ino;
+	}
+	if (fstatvfs(mhdd.dir_fds[dir_id], &stv) == 0)
+		mark->inodes = stv.f_files - stv.f_ffree;
+}
+
+// 0 - the index can be used as it is
+static const char * check_head(struct pindex_head *h, uint64_t count)
+{
+	struct pindex_mark mark;
+	int i;
+
+	if (memcmp(h->magic, PINDEX_MAGIC, sizeof(PINDEX_MAGIC)) != 0)
+		return "new index";
+	if (h->version != PINDEX_VERSION || h->slots != count ||
+			h->dirs != mhdd.cdirs)
+		return "other version or dirs";
+	if (!h->clean)
+		return "not unmounted properly";
+	if (!h->complete)
+		return "not built completely";
+	if (h->used >= count / 4 * 3)
+		return "full";
+	for (i = 0; i < mhdd.cdirs; i++) {
+		mark_dir(i, &mark);
+		if (memcmp(&mark, h->marks + i, sizeof(mark)) != 0)
+			return "dirs were changed";
+	}
+	return 0;
+}
+
+void pindex_built(void)
+{
+	if (!head)
+		return;
+	__atomic_store_n(&head->complete, 1, __ATOMIC_RELAXED);
+	mhdd_debug(MHDD_MSG, "pindex: %llu entries indexed\n",
+		(unsigned long long)__atomic_load_n(&head->used,
+			__ATOMIC_RELAXED));
+}
+
+void pindex_init(const char *file, int size)
+{
+	struct pindex_head h;
+	const char *stale;
+	uint64_t count = 1024;
+	struct stat st;
+	void *map;
+
+	if (!file)
+		return;
+	if (mhdd.cdirs > PINDEX_MAX_DIRS) {
+		mhdd_debug(MHDD_MSG, "pindex_init: more than %d dirs, "
+			"the index is off\n", PINDEX_MAX_DIRS);
+		return;
+	}
+
+	while (count < (uint64_t)size)
+		count <<= 1;
+	map_size = PINDEX_HEAD + count * sizeof(struct pindex_slot);
+
+	if ((fd = open(file, O_RDWR | O_CREAT, 0600)) == -1 ||
+			fstat(fd, &st) == -1) {
+		mhdd_debug(MHDD_MSG, "pindex_init: %s: %s\n",
+			file, strerror(errno));
+		goto fail;
+	}
+
+	memset(&h, 0, sizeof(h));
+	if (st.st_size != (off_t)map_size ||
+			pread(fd, &h, sizeof(h), 0) != sizeof(h))
+		stale = "new index";
+	else
+		stale = check_head(&h, count);
+
+	/* truncating empties the table without touching every page */
+	if (stale && (ftruncate(fd, 0) == -1 ||
+			ftruncate(fd, map_size) == -1)) {
+		mhdd_debug(MHDD_MSG, "pindex_init: %s: %s\n",
+			file, strerror(errno));
+		goto fail;
+	}
+
+	map = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		mhdd_debug(MHDD_MSG, "pindex_init: mmap %s: %s\n",
+			file, strerror(errno));
+		goto fail;
+	}
+	head = map;
+	slots = (struct pindex_slot *)((char *)map + PINDEX_HEAD);
+	mask = count - 1;
+
+	if (stale) {
+		memcpy(head->magic, PINDEX_MAGIC, sizeof(PINDEX_MAGIC));
+		head->version = PINDEX_VERSION;
+		head->dirs = mhdd.cdirs;
+		head->slots = count;
+	}
+	/* a crash leaves the index not clean */
+	head->clean = 0;
+	gen_base = head->generation;
+	msync(head, PINDEX_HEAD, MS_SYNC);
+
+	mhdd_debug(MHDD_MSG, "pindex_init: %s, %llu slots, %llu used%s%s\n",
+		file, (unsigned long long)count,
+		(unsigned long long)head->used,
+		stale ? ", rebuilding: " : "", stale ? stale : "");
+	return;
+
+fail:
+	if (fd != -1)
+		close(fd);
+	fd = -1;
+}
+
+void pindex_close(void)
+{
+	int i;
+
+	if (!head)
+		return;
+
+	/* the map stays till the exit */
+	for (i = 0; i < mhdd.cdirs; i++)
+		mark_dir(i, head->marks + i);
+	head->clean = 1;
+	msync(head, map_size, MS_SYNC);
+}
+
+void pindex_get_stats(struct pindex_stats *stats)
+{
+	memset(stats, 0, sizeof(struct pindex_stats));
+	if (!head)
+		return;
+	stats->hits = hits;
+	stats->entries = __atomic_load_n(&head->used, __ATOMIC_RELAXED);
+	stats->slots = head->slots;
+	stats->complete = __atomic_load_n(&head->complete, __ATOMIC_RELAXED);
+}
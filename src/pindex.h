@@ -0,0 +1,69 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PINDEX__H__
+#define __PINDEX__H__
+
+// persistent path -> dirs index in a mmapped file (-o index=)
+
+#define PINDEX_DEFAULT_SIZE 1048576
+#define PINDEX_MAX_DIRS     32
+
+struct pindex_stats
+{
+	unsigned long long hits;
+	unsigned long long entries;
+	unsigned long long slots;
+	int                complete;   // all the dirs are indexed
+};
+
+// open (or create) the index, empty it if it is stale
+void pindex_init(const char *file, int size);
+
+// write the dir markers, the index is valid for the next mount
+void pindex_close(void);
+
+// all the dirs are in the index (or the index is off)
+int pindex_complete(void);
+
+// the warmup has crawled all the dirs
+void pindex_built(void);
+
+// first dir having the path or -1 if unknown
+int pindex_get(const char *path);
+
+// path is (also) on dir_id
+void pindex_set(const char *path, int dir_id);
+
+// a lookup started at cache generation gen found path first on dir_id
+void pindex_found(const char *path, int dir_id, unsigned gen);
+
+// path is only on dir_id (the file was moved)
+void pindex_move(const char *path, int dir_id);
+
+// path is not on dir_id any more
+void pindex_unset(const char *path, int dir_id);
+
+// path is gone
+void pindex_forget(const char *path);
+
+// the slots older than cache generation gen are stale
+void pindex_flush(unsigned gen);
+
+void pindex_get_stats(struct pindex_stats *stats);
+
+#endif
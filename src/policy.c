@@ -0,0 +1,223 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/statvfs.h>
+
+#include "policy.h"
+#include "debug.h"
+#include "parse_options.h"
+#include "fspace.h"
+#include "tools.h"
+
+static const char *names[PLACEMENT_COUNT] = {
+	"mlimit", "roundrobin", "mostfree", "mostfreepct", "random",
+	"leastbusy"
+};
+
+static int *busy = 0;           // io in progress of each dir, atomic
+static unsigned int next = 0;   // roundrobin, atomic
+static __thread unsigned int seed = 0;
+
+int policy_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PLACEMENT_COUNT; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char * policy_name(int placement)
+{
+	if (placement < 0 || placement >= PLACEMENT_COUNT)
+		return "unknown";
+	return names[placement];
+}
+
+void policy_init(void)
+{
+	busy = calloc(mhdd.cdirs, sizeof(int));
+}
+
+void policy_io_start(int dir_id)
+{
+	if (busy && dir_id >= 0 && dir_id < mhdd.cdirs)
+		__sync_fetch_and_add(busy + dir_id, 1);
+}
+
+void policy_io_end(int dir_id)
+{
+	if (busy && dir_id >= 0 && dir_id < mhdd.cdirs)
+		__sync_fetch_and_sub(busy + dir_id, 1);
+}
+
+struct policy_dir
+{
+	fsblkcnt_t  space;      // free bytes
+	int         perc;       // free percent
+	int         fits;       // size fits above mlimit
+	int         busy;       // io in progress
+};
+
+// free space of dir i, 0 if unknown
+static int policy_dir(int i, off_t size, struct policy_dir *dir)
+{
+	struct statvfs stf;
+	fsblkcnt_t reserve = mhdd.move_limit;
+
+	memset(dir, 0, sizeof(struct policy_dir));
+	if (fspace_statvfs(i, &stf) != 0 || !stf.f_blocks)
+		return 0;
+	dir->space = (fsblkcnt_t)stf.f_bsize * stf.f_bavail;
+	dir->perc = 100 * stf.f_bavail / stf.f_blocks;
+
+	/* mlimit is the space kept free on the dir */
+	if (mhdd.move_limit <= 100)
+		reserve = (fsblkcnt_t)stf.f_bsize * stf.f_blocks *
+			mhdd.move_limit / 100;
+	dir->fits = dir->space > reserve + size;
+	return 1;
+}
+
+static int weighted_random(struct policy_dir *dirs)
+{
+	double total = 0, pick;
+	int i;
+
+	if (!seed)
+		seed = time(0) ^ (unsigned int)(size_t)&seed;
+
+	for (i = 0; i < mhdd.cdirs; i++)
+		if (dirs[i].fits)
+			total += dirs[i].space;
+	pick = total * rand_r(&seed) / ((double)RAND_MAX + 1);
+	for (i = 0; i < mhdd.cdirs; i++) {
+		if (!dirs[i].fits)
+			continue;
+		if (pick < dirs[i].space)
+			return i;
+		pick -= dirs[i].space;
+	}
+	for (i = mhdd.cdirs - 1; i >= 0 && !dirs[i].fits; i--);
+	return i;
+}
+
+int policy_select(off_t size)
+{
+	struct policy_dir *dirs = calloc(mhdd.cdirs, sizeof(struct policy_dir));
+	int i, start, best = -1, fits = 0;
+
+	for (i = 0; i < mhdd.cdirs; i++)
+		if (policy_dir(i, size, dirs + i))
+			fits += dirs[i].fits;
+
+	/* all the dirs are full: the one with the most space */
+	if (!fits) {
+		for (i = 0; i < mhdd.cdirs; i++)
+			if (dirs[i].space > size && (best < 0 ||
+					dirs[i].space > dirs[best].space))
+				best = i;
+		free(dirs);
+		if (best < 0)
+			mhdd_debug(MHDD_INFO,
+				"policy_select: Can't find freespace\n");
+		return best;
+	}
+
+	switch (mhdd.placement) {
+		case PLACEMENT_ROUNDROBIN:
+			start = __sync_fetch_and_add(&next, 1) % mhdd.cdirs;
+			for (i = 0; i < mhdd.cdirs; i++) {
+				best = (start + i) % mhdd.cdirs;
+				if (dirs[best].fits)
+					break;
+			}
+			break;
+
+		case PLACEMENT_MOSTFREEPCT:
+			for (i = 0; i < mhdd.cdirs; i++)
+				if (dirs[i].fits && (best < 0 ||
+						dirs[i].perc > dirs[best].perc))
+					best = i;
+			break;
+
+		case PLACEMENT_RANDOM:
+			best = weighted_random(dirs);
+			break;
+
+		case PLACEMENT_LEASTBUSY:
+			/* equally busy: the most free */
+			for (i = 0; i < mhdd.cdirs; i++) {
+				if (!dirs[i].fits)
+					continue;
+				dirs[i].busy = busy ?
+					__atomic_load_n(busy + i, __ATOMIC_RELAXED) : 0;
+				if (best < 0 || dirs[i].busy < dirs[best].busy ||
+						(dirs[i].busy == dirs[best].busy &&
+						dirs[i].space > dirs[best].space))
+					best = i;
+			}
+			break;
+
+		case PLACEMENT_MOSTFREE:
+		default:
+			for (i = 0; i < mhdd.cdirs; i++)
+				if (dirs[i].fits && (best < 0 ||
+						dirs[i].space > dirs[best].space))
+					best = i;
+			break;
+	}
+
+	free(dirs);
+	return best;
+}
+
+int policy_affinity(const char *path)
+{
+	char dir[PATH_MAX], *end;
+	struct policy_dir info;
+	int depth, i, dir_id;
+
+	if (mhdd.affinity <= 0 || strlen(path) >= PATH_MAX)
+		return -1;
+	strcpy(dir, path);
+
+	/* the ancestors from the parent up to the one at the depth */
+	for (;;) {
+		if (!(end = strrchr(dir, '/')) || end == dir)
+			return -1;
+		*end = 0;
+
+		for (depth = 0, i = 0; dir[i]; i++)
+			if (dir[i] == '/')
+				depth++;
+
+		dir_id = find_path_id(dir);
+		if (dir_id >= 0 && policy_dir(dir_id, 0, &info) && info.fits) {
+			mhdd_debug(MHDD_DEBUG, "policy_affinity: %s -> %s\n",
+				path, mhdd.dirs[dir_id]);
+			return dir_id;
+		}
+		if (depth <= mhdd.affinity)
+			return -1;
+	}
+}
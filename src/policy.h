@@ -0,0 +1,52 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __POLICY__H__
+#define __POLICY__H__
+
+#include <sys/types.h>
+
+// where new files and dirs are placed (-o placement=)
+
+enum placement
+{
+	PLACEMENT_MLIMIT,       // first dir above mlimit, else most free
+	PLACEMENT_ROUNDROBIN,   // dirs above mlimit in turn
+	PLACEMENT_MOSTFREE,     // most free bytes
+	PLACEMENT_MOSTFREEPCT,  // most free percent
+	PLACEMENT_RANDOM,       // random, weighted by free bytes
+	PLACEMENT_LEASTBUSY,    // fewest reads/writes in progress
+	PLACEMENT_COUNT
+};
+
+// placement by name, -1 if unknown
+int policy_parse(const char *name);
+const char * policy_name(int placement);
+
+void policy_init(void);
+
+// dir for size bytes by mhdd.placement, -1 if none has the space
+int policy_select(off_t size);
+
+// dir holding an ancestor of the new path (-o affinity=), -1 if none fits
+int policy_affinity(const char *path);
+
+// io on dir_id started / finished (for leastbusy)
+void policy_io_start(int dir_id);
+void policy_io_end(int dir_id);
+
+#endif
@@ -0,0 +1,420 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "debug.h"
+#include "parse_options.h"
+#include "pcache.h"
+#include "pindex.h"
+#include "warmup.h"
+#include "watch.h"
+#include "fspace.h"
+
+/*
+   Every thread counts into its own block, so the handlers never share
+   a cache line or take a lock.  The blocks are never freed: a block of
+   an exited thread keeps its numbers and is given to the next new one.
+   The readers sum all the blocks.
+*/
+
+struct stats_opc
+{
+	uint64_t    calls;
+	uint64_t    errors;
+	uint64_t    ns;
+	uint64_t    max_ns;
+	uint64_t    hist[STATS_BUCKETS];
+};
+
+struct stats_thread
+{
+	struct stats_opc      ops[STATS_OPS];
+	uint64_t              *dirs;    // cdirs * STATS_COUNTERS
+	int                   used;
+	struct stats_thread   *next;
+};
+
+static const char *op_names[STATS_OPS] = {
+	"getattr", "statfs", "readdir", "readlink", "open", "release",
+	"read", "write", "create", "truncate", "ftruncate", "access",
+	"mkdir", "rmdir", "unlink", "rename", "utimens", "chmod", "chown",
+	"symlink", "mknod", "fsync", "link", "read_buf", "write_buf",
+	"setxattr", "getxattr", "listxattr", "removexattr", "fallocate"
+};
+
+static struct stats_thread *threads = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t threads_key;
+static pthread_once_t threads_once = PTHREAD_ONCE_INIT;
+static __thread struct stats_thread *self = 0;
+static time_t started;
+
+// only the owner writes, the readers may see a counter a bit late
+#define STATS_ADD(p, n) __atomic_store_n((p), *(p) + (n), __ATOMIC_RELAXED)
+#define STATS_GET(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
+static void thread_exit(void *data)
+{
+	struct stats_thread *t = data;
+
+	pthread_mutex_lock(&threads_lock);
+	t->used = 0;
+	pthread_mutex_unlock(&threads_lock);
+}
+
+static void threads_key_init(void)
+{
+	pthread_key_create(&threads_key, thread_exit);
+}
+
+static struct stats_thread * get_self(void)
+{
+	struct stats_thread *t;
+
+	if (self)
+		return self;
+
+	pthread_once(&threads_once, threads_key_init);
+	pthread_mutex_lock(&threads_lock);
+	for (t = threads; t && t->used; t = t->next);
+	if (!t) {
+		t = calloc(1, sizeof(struct stats_thread));
+		t->dirs = calloc(mhdd.cdirs * STATS_COUNTERS,
+			sizeof(uint64_t));
+		t->next = threads;
+		threads = t;
+	}
+	t->used = 1;
+	pthread_mutex_unlock(&threads_lock);
+
+	pthread_setspecific(threads_key, t);
+	self = t;
+	return t;
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_op(int op, uint64_t start, int res)
+{
+	struct stats_opc *c = get_self()->ops + op;
+	uint64_t ns = stats_now() - start, us = ns / 1000;
+	int b = us ? 64 - __builtin_clzll(us) : 0;
+
+	if (b >= STATS_BUCKETS)
+		b = STATS_BUCKETS - 1;
+	STATS_ADD(&c->calls, 1);
+	if (res < 0)
+		STATS_ADD(&c->errors, 1);
+	STATS_ADD(&c->ns, ns);
+	if (ns > c->max_ns)
+		STATS_ADD(&c->max_ns, ns - c->max_ns);
+	STATS_ADD(c->hist + b, 1);
+}
+
+void stats_dir(int dir_id, int counter, long long n)
+{
+	struct stats_thread *t;
+
+	if (dir_id < 0 || dir_id >= mhdd.cdirs)
+		return;
+	t = get_self();
+	STATS_ADD(t->dirs + dir_id * STATS_COUNTERS + counter, n);
+}
+
+struct text
+{
+	char    *buf;
+	size_t  len;
+	size_t  size;
+};
+
+static void text_add(struct text *t, const char *fmt, ...)
+{
+	va_list ap;
+	int res;
+
+	for (;;) {
+		va_start(ap, fmt);
+		res = vsnprintf(t->buf + t->len, t->size - t->len, fmt, ap);
+		va_end(ap);
+		if (res < 0)
+			return;
+		if (t->len + res < t->size) {
+			t->len += res;
+			return;
+		}
+		t->size = (t->len + res + 1) * 2;
+		t->buf = realloc(t->buf, t->size);
+	}
+}
+
+char * stats_text(size_t *len)
+{
+	struct text t = { malloc(4096), 0, 4096 };
+	struct stats_opc *ops = calloc(STATS_OPS, sizeof(struct stats_opc));
+	uint64_t *dirs = calloc(mhdd.cdirs * STATS_COUNTERS, sizeof(uint64_t));
+	struct stats_thread *th;
+	struct pcache_stats pst;
+	struct pindex_stats ist;
+	const char *how;
+	unsigned long long events;
+	struct warmup_stats wst;
+	struct fspace_info fsi;
+	int i, j, nthreads = 0;
+
+	pthread_mutex_lock(&threads_lock);
+	for (th = threads; th; th = th->next, nthreads++) {
+		for (i = 0; i < STATS_OPS; i++) {
+			struct stats_opc *c = th->ops + i;
+			uint64_t max = STATS_GET(&c->max_ns);
+
+			ops[i].calls += STATS_GET(&c->calls);
+			ops[i].errors += STATS_GET(&c->errors);
+			ops[i].ns += STATS_GET(&c->ns);
+			if (max > ops[i].max_ns)
+				ops[i].max_ns = max;
+			for (j = 0; j < STATS_BUCKETS; j++)
+				ops[i].hist[j] += STATS_GET(c->hist + j);
+		}
+		for (i = 0; i < mhdd.cdirs * STATS_COUNTERS; i++)
+			dirs[i] += STATS_GET(th->dirs + i);
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	t.buf[0] = 0;
+	text_add(&t, "uptime %ld s, %d threads counted\n\n",
+		(long)(time(0) - started), nthreads);
+
+	text_add(&t, "%-12s %10s %8s %10s %10s  latency, us: calls\n",
+		"op", "calls", "errors", "avg_us", "max_us");
+	for (i = 0; i < STATS_OPS; i++) {
+		if (!ops[i].calls)
+			continue;
+		text_add(&t, "%-12s %10llu %8llu %10llu %10llu ",
+			op_names[i],
+			(unsigned long long)ops[i].calls,
+			(unsigned long long)ops[i].errors,
+			(unsigned long long)(ops[i].ns / ops[i].calls / 1000),
+			(unsigned long long)(ops[i].max_ns / 1000));
+		for (j = 0; j < STATS_BUCKETS; j++) {
+			if (!ops[i].hist[j])
+				continue;
+			if (j == STATS_BUCKETS - 1)
+				text_add(&t, " >=%llu:%llu",
+					1ULL << (j - 1),
+					(unsigned long long)ops[i].hist[j]);
+			else
+				text_add(&t, " <%llu:%llu", 1ULL << j,
+					(unsigned long long)ops[i].hist[j]);
+		}
+		text_add(&t, "\n");
+	}
+
+	for (i = 0; i < mhdd.cdirs; i++) {
+		uint64_t *d = dirs + i * STATS_COUNTERS;
+
+		fspace_get_info(i, &fsi);
+		text_add(&t, "\n%s:\n"
+			"  syscalls %llu, read %llu, written %llu, enospc %llu\n"
+			"  moves started %llu, done %llu, failed %llu, "
+			"moved %llu\n"
+			"  free space age %ld s, drift %lld, pending %lld\n",
+			mhdd.dirs[i],
+			(unsigned long long)d[STATS_SYSCALLS],
+			(unsigned long long)d[STATS_BYTES_READ],
+			(unsigned long long)d[STATS_BYTES_WRITTEN],
+			(unsigned long long)d[STATS_ENOSPC],
+			(unsigned long long)d[STATS_MOVES_STARTED],
+			(unsigned long long)d[STATS_MOVES_DONE],
+			(unsigned long long)d[STATS_MOVES_FAILED],
+			(unsigned long long)d[STATS_BYTES_MOVED],
+			(long)fsi.age, fsi.drift, fsi.adjust);
+	}
+
+	pcache_get_stats(&pst);
+	text_add(&t, "\npath cache: hits %llu, misses %llu, evictions %llu, "
+		"entries %llu\n", pst.hits, pst.misses, pst.evictions,
+		pst.entries);
+	pindex_get_stats(&ist);
+	if (ist.slots)
+		text_add(&t, "index: hits %llu, entries %llu of %llu%s\n",
+			ist.hits, ist.entries, ist.slots,
+			ist.complete ? "" : ", building");
+	if (warmup_get_stats(&wst))
+		text_add(&t, "warmup: %llu entries in %ld s, %d dirs left\n",
+			wst.entries, (long)wst.seconds, wst.running);
+	if (watch_get_stats(&how, &events))
+		text_add(&t, "watch: %s, %llu changes\n", how, events);
+	text_add(&t, "log: %llu messages dropped\n", mhdd_debug_dropped());
+
+	free(ops);
+	free(dirs);
+	*len = t.len;
+	return t.buf;
+}
+
+static void * stats_thread(void * arg)
+{
+	sigset_t set;
+	char *text;
+	size_t len;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	for (;;) {
+		if (sigwait(&set, &sig) != 0)
+			continue;
+		text = stats_text(&len);
+		mhdd_debug(MHDD_MSG, "stats:\n%s", text);
+		free(text);
+	}
+	return 0;
+}
+
+void stats_init(void)
+{
+	sigset_t set;
+
+	started = time(0);
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, 0);
+}
+
+void stats_start(void)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, 0, stats_thread, 0) != 0) {
+		mhdd_debug(MHDD_MSG, "stats_start: can not start thread: %s\n",
+			strerror(errno));
+		return;
+	}
+	pthread_detach(thread);
+}
+
+int stats_is_path(const char *path)
+{
+	size_t len = sizeof(STATS_DIR) - 1;
+
+	return strncmp(path, STATS_DIR, len) == 0 &&
+		(path[len] == 0 || path[len] == '/');
+}
+
+int stats_reserved(const char *path)
+{
+	struct stat st;
+
+	if (!stats_is_path(path))
+		return 0;
+	return stats_getattr(path, &st) == 0 ? -EEXIST : -EPERM;
+}
+
+int stats_getattr(const char *path, struct stat *buf)
+{
+	char *text;
+	size_t len;
+
+	memset(buf, 0, sizeof(struct stat));
+	buf->st_uid = getuid();
+	buf->st_gid = getgid();
+	if (strcmp(path, STATS_DIR) == 0) {
+		buf->st_mode = S_IFDIR | 0555;
+		buf->st_nlink = 2;
+		buf->st_atime = buf->st_mtime = buf->st_ctime = started;
+		return 0;
+	}
+	if (strcmp(path, STATS_FILE) != 0)
+		return -ENOENT;
+
+	text = stats_text(&len);
+	free(text);
+	buf->st_mode = S_IFREG | 0444;
+	buf->st_nlink = 1;
+	buf->st_size = len;
+	buf->st_atime = buf->st_mtime = buf->st_ctime = time(0);
+	return 0;
+}
+
+int stats_open(const char *path, struct fuse_file_info *fi)
+{
+	if (strcmp(path, STATS_DIR) == 0)
+		return -EISDIR;
+	if (strcmp(path, STATS_FILE) != 0)
+		return -ENOENT;
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+
+	/* the size changes with every read */
+	fi->fh = STATS_FH;
+	fi->direct_io = 1;
+	fi->keep_cache = 0;
+	return 0;
+}
+
+int stats_read(char *buf, size_t size, off_t offset)
+{
+	char *text;
+	size_t len;
+
+	text = stats_text(&len);
+	if (offset >= len) {
+		free(text);
+		return 0;
+	}
+	if (size > len - offset)
+		size = len - offset;
+	memcpy(buf, text + offset, size);
+	free(text);
+	return size;
+}
+
+int stats_readdir(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+	if (strcmp(path, STATS_FILE) == 0)
+		return -ENOTDIR;
+	if (strcmp(path, STATS_DIR) != 0)
+		return -ENOENT;
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFDIR;
+	filler(buf, ".", &st, 0);
+	filler(buf, "..", &st, 0);
+	st.st_mode = S_IFREG;
+	filler(buf, STATS_FILE + sizeof(STATS_DIR), &st, 0);
+	return 0;
+}
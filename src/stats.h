@@ -0,0 +1,108 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __STATS__H__
+#define __STATS__H__
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+// per handler and per dir counters, /.mhddfs/stats and SIGUSR1 dump
+
+#define STATS_DIR   "/.mhddfs"
+#define STATS_FILE  "/.mhddfs/stats"
+
+// fh of the opened stats file (flist ids start from 1)
+#define STATS_FH    0
+
+// latency buckets: [2^(i-1), 2^i) microseconds, the last is open
+#define STATS_BUCKETS 24
+
+enum stats_op
+{
+	STATS_GETATTR,
+	STATS_STATFS,
+	STATS_READDIR,
+	STATS_READLINK,
+	STATS_OPEN,
+	STATS_RELEASE,
+	STATS_READ,
+	STATS_WRITE,
+	STATS_CREATE,
+	STATS_TRUNCATE,
+	STATS_FTRUNCATE,
+	STATS_ACCESS,
+	STATS_MKDIR,
+	STATS_RMDIR,
+	STATS_UNLINK,
+	STATS_RENAME,
+	STATS_UTIMENS,
+	STATS_CHMOD,
+	STATS_CHOWN,
+	STATS_SYMLINK,
+	STATS_MKNOD,
+	STATS_FSYNC,
+	STATS_LINK,
+	STATS_READ_BUF,
+	STATS_WRITE_BUF,
+	STATS_SETXATTR,
+	STATS_GETXATTR,
+	STATS_LISTXATTR,
+	STATS_REMOVEXATTR,
+	STATS_FALLOCATE,
+	STATS_OPS
+};
+
+enum stats_counter
+{
+	STATS_SYSCALLS,
+	STATS_BYTES_READ,
+	STATS_BYTES_WRITTEN,
+	STATS_ENOSPC,
+	STATS_MOVES_STARTED,
+	STATS_MOVES_DONE,
+	STATS_MOVES_FAILED,
+	STATS_BYTES_MOVED,
+	STATS_COUNTERS
+};
+
+// block SIGUSR1 (before fuse starts its threads)
+void stats_init(void);
+// start the SIGUSR1 dump thread
+void stats_start(void);
+
+// monotonic time in ns for stats_op
+uint64_t stats_now(void);
+// handler op started at start returned res
+void stats_op(int op, uint64_t start, int res);
+// add n to counter of dir_id
+void stats_dir(int dir_id, int counter, long long n);
+
+// the text of the stats file (malloced)
+char * stats_text(size_t *len);
+
+// path is /.mhddfs or below
+int stats_is_path(const char *path);
+// nothing can be made below /.mhddfs: 0, -EEXIST or -EPERM
+int stats_reserved(const char *path);
+int stats_getattr(const char *path, struct stat *buf);
+int stats_open(const char *path, struct fuse_file_info *fi);
+int stats_read(char *buf, size_t size, off_t offset);
+int stats_readdir(const char *path, void *buf, fuse_fill_dir_t filler);
+
+#endif
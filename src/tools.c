@@ -18,6 +18,7 @@
    Modified by Glenn Washburn <gwashburn@Crossroads.com>
 	   (added support for extended attributes.)
  */
+#define _GNU_SOURCE     // O_PATH, O_TMPFILE
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,10 +27,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
-#include <utime.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <sys/time.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 
 #ifndef WITHOUT_XATTR
 #include <attr/xattr.h>
@@ -38,6 +42,13 @@
 #include "tools.h"
 #include "debug.h"
 #include "parse_options.h"
+#include "pcache.h"
+#include "fspace.h"
+#include "tpool.h"
+#include "uring.h"
+#include "lowlevel.h"
+#include "stats.h"
+#include "policy.h"
 
 
 // get diridx for maximum free space
@@ -47,9 +58,12 @@ int get_free_dir(void)
 	struct statvfs stf;
 	fsblkcnt_t max_space = 0;
 
+	if (mhdd.placement != PLACEMENT_MLIMIT)
+		return policy_select(0);
+
 	for (max = i = 0; i < mhdd.cdirs; i++) {
 
-		if (statvfs(mhdd.dirs[i], &stf) != 0)
+		if (fspace_statvfs(i, &stf) != 0)
 			continue;
 		fsblkcnt_t space  = stf.f_bsize;
 		space *= stf.f_bavail;
@@ -99,17 +113,29 @@ int get_free_dir(void)
 	return max;
 }
 
+int get_new_dir(const char *path)
+{
+	int dir_id = policy_affinity(path);
+
+	if (dir_id >= 0)
+		return dir_id;
+	return get_free_dir();
+}
+
 // find mount point with free space > size
 // -1 if not found
-static int find_free_space(off_t size)
+int find_free_space(off_t size)
 {
 	int i, max;
 	struct statvfs stf;
 	fsblkcnt_t max_space=0;
 
+	if (mhdd.placement != PLACEMENT_MLIMIT)
+		return policy_select(size);
+
 	for (max=-1,i=0; i<mhdd.cdirs; i++)
 	{
-		if (statvfs(mhdd.dirs[i], &stf)!=0) continue;
+		if (fspace_statvfs(i, &stf)!=0) continue;
 		fsblkcnt_t space  = stf.f_bsize;
 		space *= stf.f_bavail;
 
@@ -124,7 +150,7 @@ static int find_free_space(off_t size)
 	return max;
 }
 
-static int reopen_files(struct flist * file, const char *new_name)
+int reopen_files(struct flist * file, const char *new_name, int dir_id)
 {
 	int i;
 	struct flist ** rlist;
@@ -146,7 +172,8 @@ static int reopen_files(struct flist * file, const char *new_name)
 		flags &= ~(O_EXCL|O_TRUNC);
 
 		// open
-		if ((fh = open(new_name, flags)) == -1) {
+		fh = openat(mhdd.dir_fds[dir_id], rel_path(file->name), flags);
+		if (fh == -1) {
 			mhdd_debug(MHDD_INFO,
 				"reopen_files: error reopen: %s\n",
 				strerror(errno));
@@ -154,6 +181,7 @@ static int reopen_files(struct flist * file, const char *new_name)
 				error = errno;
 				break;
 			}
+			uring_unregister(next->fh);
 			close(next->fh);
 		}
 		else
@@ -181,6 +209,8 @@ static int reopen_files(struct flist * file, const char *new_name)
 					break;
 				}
 			}
+			// the ring still has the old file in this slot
+			uring_register(next->fh);
 			// close temporary filehandle
 			mhdd_debug(MHDD_MSG,
 				"reopen_files: reopened %s (to %s) old h=%x "
@@ -199,21 +229,164 @@ static int reopen_files(struct flist * file, const char *new_name)
 	for (i = 0; rlist[i]; i++) {
 		free(rlist[i]->real_name);
 		rlist[i]->real_name = strdup(new_name);
+		rlist[i]->dir_id = dir_id;
 	}
+
+	/* same data and mtime: the kernel keeps its cached pages */
+	lowlevel_moved(file->name, dir_id);
 	free(rlist);
 	return 0;
 }
 
+/* copy the rest of in to out, return bytes copied or -errno
+   (-ECANCELED once *cancel is set) */
+off_t copy_data(int in, int out, const char **method, const int *cancel)
+{
+	size_t chunk = mhdd.move_chunk;
+	off_t done = 0;
+	ssize_t res;
+	char *buf;
+
+#ifdef __NR_copy_file_range
+	/* in-kernel copy, can be reflink or server-side copy */
+	*method = "copy_file_range";
+	while ((res = syscall(__NR_copy_file_range,
+			in, NULL, out, NULL, chunk, 0)) > 0) {
+		done += res;
+		if (cancel && *cancel)
+			return -ECANCELED;
+	}
+	if (res == 0)
+		return done;
+	if (done || (errno != ENOSYS && errno != EXDEV &&
+			errno != EINVAL && errno != EOPNOTSUPP))
+		return -errno;
+#endif
+
+	/* in-kernel copy through the page cache */
+	*method = "sendfile";
+	while ((res = sendfile(out, in, NULL, chunk)) > 0) {
+		done += res;
+		if (cancel && *cancel)
+			return -ECANCELED;
+	}
+	if (res == 0)
+		return done;
+	if (done || (errno != ENOSYS && errno != EINVAL))
+		return -errno;
+
+	/* userspace copy with an aligned buffer */
+	*method = "read/write";
+	if (posix_memalign((void **)&buf, MOVE_BUF_ALIGN, chunk) != 0)
+		return -ENOMEM;
+	while ((res = read(in, buf, chunk)) > 0) {
+		char *ptr = buf;
+		if (cancel && *cancel) {
+			free(buf);
+			return -ECANCELED;
+		}
+		while (res > 0) {
+			ssize_t wres = write(out, ptr, res);
+			if (wres == -1) {
+				res = -errno;
+				free(buf);
+				return res;
+			}
+			ptr += wres;
+			res -= wres;
+			done += wres;
+		}
+	}
+	if (res == -1)
+		done = -errno;
+	free(buf);
+	return done;
+}
+
+/*
+   The copy of a moved file is an unnamed O_TMPFILE in its parent on
+   the new dir (a hidden temporary name where it is not supported).  It
+   gets the name by move_tmp_link under the flist wrlock, so the path
+   is never on two dirs while the data is copied.
+*/
+int move_tmp_open(int dir_id, const char *path, char *tmp)
+{
+	static unsigned long seq = 0;
+	char parent[PATH_MAX];
+	const char *dir = path_parent(parent, path) ? rel_path(parent) : ".";
+	int fd;
+
+	tmp[0] = 0;
+#ifdef O_TMPFILE
+	fd = openat(mhdd.dir_fds[dir_id], dir, O_TMPFILE | O_WRONLY,
+		S_IRUSR | S_IWUSR);
+	if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR &&
+			errno != EINVAL))
+		return fd;
+#endif
+	if (snprintf(tmp, PATH_MAX, "%s/.mhddfs-move.%d.%lu", dir,
+			(int)getpid(), __sync_add_and_fetch(&seq, 1)) >=
+			PATH_MAX) {
+		tmp[0] = 0;
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = openat(mhdd.dir_fds[dir_id], tmp, O_WRONLY | O_CREAT | O_EXCL,
+		S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		tmp[0] = 0;
+	return fd;
+}
+
+int move_tmp_link(int dir_id, const char *path, int fd, char *tmp)
+{
+	int dirfd = mhdd.dir_fds[dir_id];
+	const char *name = rel_path(path);
+	char proc[64];
+	int i;
+
+	if (tmp[0]) {
+		if (renameat(dirfd, tmp, dirfd, name) != 0)
+			return -errno;
+		tmp[0] = 0;
+		return 0;
+	}
+
+	/* AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, /proc does not */
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	for (i = 0; i < 2; i++) {
+		if (linkat(AT_FDCWD, proc, dirfd, name, AT_SYMLINK_FOLLOW) == 0 ||
+				(errno == ENOENT && linkat(fd, "", dirfd, name,
+					AT_EMPTY_PATH) == 0))
+			return 0;
+		/* a path left on dir_id is shadowed by the moved one */
+		if (errno != EEXIST || unlinkat(dirfd, name, 0) != 0)
+			break;
+	}
+	return -errno;
+}
+
+void move_tmp_drop(int dir_id, char *tmp)
+{
+	if (tmp[0])
+		unlinkat(mhdd.dir_fds[dir_id], tmp, 0);
+	tmp[0] = 0;
+}
+
 int move_file(struct flist * file, off_t wsize)
 {
-	char *from, *to, *buf;
+	char *from, *to;
+	const char *method;
 	off_t size;
-	FILE *input, *output;
-	int ret, dir_id;
-	struct utimbuf ftime = {0};
+	int input, output;
+	int ret, dir_id, src_id;
+	struct timeval start, stop;
+	double elapsed;
+	struct timespec ftime[2];
 	struct statvfs svf;
 	fsblkcnt_t space;
 	struct stat st;
+	char tmp[PATH_MAX];
 
 	mhdd_debug(MHDD_MSG, "move_file: %s\n", file->real_name);
 
@@ -222,7 +395,7 @@ int move_file(struct flist * file, off_t wsize)
 	from=file->real_name;
 
 	/* We need to check if already moved */
-	if (statvfs(from, &svf) != 0)
+	if (fstatvfs(mhdd.dir_fds[file->dir_id], &svf) != 0)
 		return -errno;
 	space = svf.f_bsize;
 	space *= svf.f_bavail;
@@ -257,52 +430,73 @@ int move_file(struct flist * file, off_t wsize)
 		return -1;
 	}
 
-	if (!(input = fopen(from, "r")))
+	input = openat(mhdd.dir_fds[file->dir_id], rel_path(file->name),
+		O_RDONLY);
+	if (input == -1)
 		return -errno;
 
 	create_parent_dirs(dir_id, file->name);
 
 	to = create_path(mhdd.dirs[dir_id], file->name);
-	if (!(output = fopen(to, "w+"))) {
+	output = move_tmp_open(dir_id, file->name, tmp);
+	if (output == -1) {
 		ret = -errno;
 		mhdd_debug(MHDD_MSG, "move_file: error create %s: %s\n",
 				to, strerror(errno));
 		free(to);
-		fclose(input);
+		close(input);
 		return(ret);
 	}
 
 	mhdd_debug(MHDD_MSG, "move_file: move %s to %s\n", from, to);
+	stats_dir(file->dir_id, STATS_MOVES_STARTED, 1);
 
 	// move data
-	buf=(char *)calloc(sizeof(char), MOVE_BLOCK_SIZE);
-	while((size = fread(buf, sizeof(char), MOVE_BLOCK_SIZE, input))) {
-		if (size != fwrite(buf, sizeof(char), size, output)) {
-			mhdd_debug(MHDD_MSG,
-				"move_file: error move data to %s: %s\n",
-				to, strerror(errno));
-			fclose(output);
-			fclose(input);
-			free(buf);
-			unlink(to);
-			free(to);
-			return -1;
-		}
+	gettimeofday(&start, 0);
+	policy_io_start(dir_id);
+	size = copy_data(input, output, &method, 0);
+	policy_io_end(dir_id);
+	if (size < 0) {
+		mhdd_debug(MHDD_MSG,
+			"move_file: error move data to %s: %s\n",
+			to, strerror(-size));
+		stats_dir(file->dir_id, STATS_MOVES_FAILED, 1);
+		close(output);
+		close(input);
+		move_tmp_drop(dir_id, tmp);
+		free(to);
+		return -1;
 	}
-	free(buf);
+	gettimeofday(&stop, 0);
+	elapsed = (stop.tv_sec - start.tv_sec) +
+		(stop.tv_usec - start.tv_usec) / 1000000.0;
 
-	mhdd_debug(MHDD_MSG, "move_file: done move data\n");
-	fclose(input);
+	mhdd_debug(MHDD_MSG, "move_file: done move data, %lld bytes "
+		"in %.2fs (%.1f MB/s, %s)\n",
+		(long long)size, elapsed,
+		elapsed > 0 ? size / elapsed / (1024 * 1024) : 0.0,
+		method);
+	close(input);
 
 	// owner/group/permissions
-	fchmod(fileno(output), st.st_mode);
-	fchown(fileno(output), st.st_uid, st.st_gid);
-	fclose(output);
+	fchmod(output, st.st_mode);
+	fchown(output, st.st_uid, st.st_gid);
 
 	// time
-	ftime.actime = st.st_atime;
-	ftime.modtime = st.st_mtime;
-	utime(to, &ftime);
+	ftime[0] = st.st_atim;
+	ftime[1] = st.st_mtim;
+	futimens(output, ftime);
+
+	ret = move_tmp_link(dir_id, file->name, output, tmp);
+	close(output);
+	if (ret) {
+		mhdd_debug(MHDD_MSG, "move_file: error link %s: %s\n",
+			to, strerror(-ret));
+		stats_dir(file->dir_id, STATS_MOVES_FAILED, 1);
+		move_tmp_drop(dir_id, tmp);
+		free(to);
+		return ret;
+	}
 
 #ifndef WITHOUT_XATTR
         // extended attributes
@@ -314,10 +508,18 @@ int move_file(struct flist * file, off_t wsize)
 
 
 	from = strdup(from);
-	if ((ret = reopen_files(file, to)) == 0)
-		unlink(from);
-	else
-		unlink(to);
+	src_id = file->dir_id;
+	if ((ret = reopen_files(file, to, dir_id)) == 0) {
+		unlinkat(mhdd.dir_fds[src_id], rel_path(file->name), 0);
+		pcache_move(file->name, dir_id);
+		fspace_used(dir_id, st.st_size);
+		fspace_refresh(src_id);
+		stats_dir(src_id, STATS_MOVES_DONE, 1);
+		stats_dir(src_id, STATS_BYTES_MOVED, size);
+	} else {
+		unlinkat(mhdd.dir_fds[dir_id], rel_path(file->name), 0);
+		stats_dir(src_id, STATS_MOVES_FAILED, 1);
+	}
 
 	mhdd_debug(MHDD_MSG, "move_file: %s -> %s: done, code=%d\n",
 		from, to, ret);
@@ -397,167 +599,313 @@ int copy_xattrs(const char *from, const char *to)
 }
 #endif
 
-char * create_path(const char *dir, const char * file)
+/*
+   The paths are built in buffers of the callers (PATH_MAX on the stack
+   for the hot operations), the allocating helpers are kept for the
+   paths that are stored.
+*/
+
+// dir/file into buf of size, the length of the path (>= size - too long)
+static size_t join_path(char *buf, size_t size,
+		const char *dir, const char *file)
 {
 	if (file[0]=='/') file++;
-	int plen=strlen(dir);
-	int flen=strlen(file);
-
-	char *path=(char *)calloc(plen+flen+2, sizeof(char));
+	size_t dlen=strlen(dir), flen=strlen(file);
+	int slash=!dlen || dir[dlen-1]!='/';
+	size_t len=dlen+slash+flen;
+
+	if (len>=size)
+		return len;
+	memcpy(buf, dir, dlen);
+	if (slash) buf[dlen]='/';
+	memcpy(buf+dlen+slash, file, flen+1);
+	if (len>1 && buf[len-1]=='/') buf[--len]=0;
+	return len;
+}
 
-	if (dir[plen-1]=='/')
-	{
-		sprintf(path, "%s%s", dir, file);
-	}
-	else
+char * path_join(char *buf, const char *dir, const char *file)
+{
+	if (join_path(buf, PATH_MAX, dir, file)>=PATH_MAX)
 	{
-		sprintf(path, "%s/%s", dir, file);
+		errno=ENAMETOOLONG;
+		return 0;
 	}
+	return buf;
+}
+
+char * dir_path(char *buf, int dir_id, const char *file)
+{
+	return path_join(buf, mhdd.dirs[dir_id], file);
+}
 
-	plen=strlen(path);
-	if (plen>1 && path[plen-1]=='/') path[plen-1]=0;
+char * create_path(const char *dir, const char * file)
+{
+	size_t size=strlen(dir)+strlen(file)+2;
+	char *path=malloc(size);
 
-	/*     mhdd_debug(MHDD_DEBUG, "create_path: %s\n", path); */
-	return(path);
+	if (path) join_path(path, size, dir, file);
+	return path;
 }
 
-char * find_path(const char *file)
+struct path_probe
 {
-	int i;
+	char    *file;
+	char    found[];    // found[i] - file is in dir i
+};
+
+static void probe_dir(void *data, int i)
+{
+	struct path_probe *probe = data;
 	struct stat st;
+	probe->found[i] = fstatat(mhdd.dir_fds[i], rel_path(probe->file),
+		&st, AT_SYMLINK_NOFOLLOW) == 0;
+	stats_dir(i, STATS_SYSCALLS, 1);
+}
 
-	for (i=0; i<mhdd.cdirs; i++)
-	{
-		char *path=create_path(mhdd.dirs[i], file);
-		if (lstat(path, &st)==0) return path;
-		free(path);
+/* probe all the dirs at once, return the first one containing file */
+static int find_path_parallel(const char *file)
+{
+	struct path_probe *probe = calloc(1,
+		sizeof(struct path_probe) + mhdd.cdirs + strlen(file) + 1);
+	struct tpool_batch *batch;
+	int i;
+
+	probe->file = probe->found + mhdd.cdirs;
+	strcpy(probe->file, file);
+
+	/* the later dirs are not waited for once an earlier one has it */
+	batch = tpool_start(probe_dir, probe, mhdd.cdirs);
+	for (i = 0; i < mhdd.cdirs; i++) {
+		tpool_wait(batch, i);
+		if (probe->found[i])
+			break;
 	}
-	return 0;
+	tpool_free(batch);
+	return i < mhdd.cdirs ? i : -1;
 }
 
-int find_path_id(const char *file)
+int open_dir(const char *dir)
+{
+	return open(dir, O_PATH);
+}
+
+const char * rel_path(const char *path)
 {
+	while (*path == '/')
+		path++;
+	return *path ? path : ".";
+}
+
+/* find the first dir containing file and lstat it there */
+int find_path_stat(const char *file, struct stat *st)
+{
+	const char *rel = rel_path(file);
+	unsigned gen = pcache_generation();
 	int i;
-	struct stat st;
+
+	/* try cached location first */
+	if ((i = pcache_get(file)) != -1 && i < mhdd.cdirs)
+	{
+		stats_dir(i, STATS_SYSCALLS, 1);
+		if (fstatat(mhdd.dir_fds[i], rel, st, AT_SYMLINK_NOFOLLOW)==0)
+			return i;
+		pcache_forget(file);
+	}
+
+	if (mhdd.parallel_lookup && mhdd.cdirs > 1)
+	{
+		if ((i=find_path_parallel(file)) == -1)
+			return -1;
+		pcache_found(file, i, gen);
+		stats_dir(i, STATS_SYSCALLS, 1);
+		if (fstatat(mhdd.dir_fds[i], rel, st, AT_SYMLINK_NOFOLLOW)!=0)
+			return -1;
+		return i;
+	}
 
 	for (i=0; i<mhdd.cdirs; i++)
 	{
-		char *path=create_path(mhdd.dirs[i], file);
-		if (lstat(path, &st)==0)
+		stats_dir(i, STATS_SYSCALLS, 1);
+		if (fstatat(mhdd.dir_fds[i], rel, st, AT_SYMLINK_NOFOLLOW)==0)
 		{
-			free(path);
+			pcache_found(file, i, gen);
 			return i;
 		}
-		free(path);
 	}
 	return -1;
 }
 
+int find_path_id(const char *file)
+{
+	struct stat st;
+	return find_path_stat(file, &st);
+}
+
+/* find the first dir containing file, return malloced path or 0 */
+char * find_path_dir(const char *file, int *dir_id)
+{
+	if ((*dir_id=find_path_id(file)) == -1)
+		return 0;
+	return create_path(mhdd.dirs[*dir_id], file);
+}
 
-int create_parent_dirs(int dir_id, const char *path)
+char * find_path_buf(char *buf, const char *file)
 {
-	mhdd_debug(MHDD_DEBUG,
-		"create_parent_dirs: dir_id=%d, path=%s\n", dir_id, path);
-	char *parent=get_parent_path(path);
-	if (!parent) return 0;
+	int dir_id=find_path_id(file);
+	if (dir_id==-1) return 0;
+	return dir_path(buf, dir_id, file);
+}
 
-	char *exists=find_path(parent);
-	if (!exists) { free(parent); errno=EFAULT; return -errno; }
+char * find_path(const char *file)
+{
+	int dir_id;
+	return find_path_dir(file, &dir_id);
+}
 
 
-	char *path_parent=create_path(mhdd.dirs[dir_id], parent);
+// parent is cut and restored in place while its parents are made
+static int make_parent(int dir_id, char *parent)
+{
+	int exists=find_path_id(parent);
+	if (exists==-1) { errno=EFAULT; return -errno; }
+
+	int fd=mhdd.dir_fds[dir_id];
+	const char *rel=rel_path(parent);
 	struct stat st;
 
 	// already exists
-	if (stat(path_parent, &st)==0)
-	{
-		free(exists);
-		free(path_parent);
-		free(parent);
+	if (fstatat(fd, rel, &st, 0)==0)
 		return 0;
-	}
 
 	// create parent dirs
-	int res=create_parent_dirs(dir_id, parent);
-
-	if (res!=0)
+	char *slash=strrchr(parent, '/');
+	int res=0;
+	if (slash && slash!=parent)
 	{
-		free(path_parent);
-		free(parent);
-		free(exists);
-		return res;
+		*slash=0;
+		res=make_parent(dir_id, parent);
+		*slash='/';
 	}
+	if (res!=0)
+		return res;
 
 	// get stat from exists dir
-	if (stat(exists, &st)!=0)
-	{
-		free(exists);
-		free(path_parent);
-		free(parent);
+	if (fstatat(mhdd.dir_fds[exists], rel, &st, 0)!=0)
 		return -errno;
-	}
-	res=mkdir(path_parent, st.st_mode);
+	res=mkdirat(fd, rel, st.st_mode);
 	if (res==0)
 	{
-		chown(path_parent, st.st_uid, st.st_gid);
-		chmod(path_parent, st.st_mode);
+		fchownat(fd, rel, st.st_uid, st.st_gid, 0);
+		fchmodat(fd, rel, st.st_mode, 0);
+		/* dir_id can be placed before the cached one */
+		pcache_forget(parent);
 	}
 	else
 	{
 		res=-errno;
 		mhdd_debug(MHDD_DEBUG,
-			"create_parent_dirs: can not create dir %s: %s\n",
-			path_parent,
+			"create_parent_dirs: can not create dir %s on %s: %s\n",
+			parent, mhdd.dirs[dir_id],
 			strerror(errno));
 	}
 
 #ifndef WITHOUT_XATTR
-        // copy extended attributes of parent dir
-        if (copy_xattrs(exists, path_parent) == -1)
-            mhdd_debug(MHDD_MSG,
-                    "copy_xattrs: error copying xattrs from %s to %s\n",
-                    exists, path_parent);
+	// copy extended attributes of parent dir
+	char path_exists[PATH_MAX], path_parent[PATH_MAX];
+	if (dir_path(path_exists, exists, parent) &&
+		dir_path(path_parent, dir_id, parent) &&
+		copy_xattrs(path_exists, path_parent) == -1)
+		mhdd_debug(MHDD_MSG,
+			"copy_xattrs: error copying xattrs from %s to %s\n",
+			path_exists, path_parent);
 #endif
 
-	free(exists);
-	free(path_parent);
-	free(parent);
 	return res;
 }
 
+int create_parent_dirs(int dir_id, const char *path)
+{
+	mhdd_debug(MHDD_DEBUG,
+		"create_parent_dirs: dir_id=%d, path=%s\n", dir_id, path);
+	char parent[PATH_MAX];
+	if (!path_parent(parent, path)) return 0;
+	return make_parent(dir_id, parent);
+}
+
+// length of the parent of path (0 - no parent)
+static size_t parent_len(const char *path)
+{
+	size_t len=strlen(path);
+	if (len && path[len-1]=='/') len--;
+	while(len && path[len-1]!='/') len--;
+	if (len>1 && path[len-1]=='/') len--;
+	return len;
+}
+
+// start and length of the last name of path
+static const char * base_name(const char *path, size_t *len)
+{
+	size_t plen=strlen(path);
+	if (plen && path[plen-1]=='/') plen--;
+	const char *file=path+plen;
+	while(file>path && file[-1]!='/') file--;
+	*len=path+plen-file;
+	return file;
+}
+
+char * path_parent(char *buf, const char *path)
+{
+	size_t len=parent_len(path);
+	if (!len || len>=PATH_MAX) return 0;
+	memcpy(buf, path, len);
+	buf[len]=0;
+	return buf;
+}
+
+char * path_base(char *buf, const char *path)
+{
+	size_t len;
+	const char *file=base_name(path, &len);
+	if (len>=PATH_MAX) return 0;
+	memcpy(buf, file, len);
+	buf[len]=0;
+	return buf;
+}
+
 char * get_parent_path(const char * path)
 {
-	char *dir=strdup(path);
-	int len=strlen(dir);
-	if (len && dir[len-1]=='/') dir[--len]=0;
-	while(len && dir[len-1]!='/') dir[--len]=0;
-	if (len>1 && dir[len-1]=='/') dir[--len]=0;
-	if (len) return dir;
-	free(dir);
-	return 0;
+	size_t len=parent_len(path);
+	if (!len) return 0;
+	char *dir=malloc(len+1);
+	if (!dir) return 0;
+	memcpy(dir, path, len);
+	dir[len]=0;
+	return dir;
 }
 
 char * get_base_name(const char *path)
 {
-	char *dir=strdup(path);
-	int len=strlen(dir);
-	if (len && dir[len-1]=='/') dir[--len]=0;
-	char *file=strrchr(dir, '/');
-	if (file)
-	{
-		file++;
-		strcpy(dir, file);
-	}
-	return dir;
+	size_t len;
+	const char *file=base_name(path, &len);
+	char *name=malloc(len+1);
+	if (!name) return 0;
+	memcpy(name, file, len);
+	name[len]=0;
+	return name;
 }
 
 /* return true if directory is empty */
-int dir_is_empty(const char *path)
+int dir_is_empty(int dirfd, const char *path)
 {
-	DIR * dir = opendir(path);
+	int fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY);
+	DIR * dir;
 	struct dirent *de;
-	if (!dir)
+	if (fd == -1)
+		return -1;
+	if (!(dir = fdopendir(fd))) {
+		close(fd);
 		return -1;
+	}
 	while((de = readdir(dir))) {
 		if (strcmp(de->d_name, ".") == 0) continue;
 		if (strcmp(de->d_name, "..") == 0) continue;
@@ -568,3 +916,26 @@ int dir_is_empty(const char *path)
 	closedir(dir);
 	return 1;
 }
+
+static __thread int caller_set = 0;
+static __thread uid_t caller_uid;
+static __thread gid_t caller_gid;
+
+void set_caller(uid_t uid, gid_t gid)
+{
+	caller_set = 1;
+	caller_uid = uid;
+	caller_gid = gid;
+}
+
+void get_caller(uid_t *uid, gid_t *gid)
+{
+	if (caller_set) {
+		*uid = caller_uid;
+		*gid = caller_gid;
+		return;
+	}
+	struct fuse_context *ctx = fuse_get_context();
+	*uid = ctx->uid;
+	*gid = ctx->gid;
+}
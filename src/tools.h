@@ -23,13 +23,27 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "flist.h"
 
 int get_free_dir(void);
+// dir for the new path: near its parent (affinity) or get_free_dir
+int get_new_dir(const char *path);
 char * create_path(const char *dir, const char * file);
 char * find_path(const char *file);
+char * find_path_dir(const char *file, int *dir_id);
 int find_path_id(const char *file);
+// find_path in buf of PATH_MAX
+char * find_path_buf(char *buf, const char *file);
+// dir of the file (or -1) and its lstat there, no path is built
+int find_path_stat(const char *file, struct stat *st);
+
+// O_PATH fd of a dir for the *at calls
+int open_dir(const char *dir);
+// path relative to the dir fds ("." for the root)
+const char * rel_path(const char *path);
 
 int create_parent_dirs(int dir_id, const char *path);
 int copy_xattrs(const char *from, const char *to);
@@ -38,15 +52,43 @@ int copy_xattrs(const char *from, const char *to);
 // true if success
 int move_file(struct flist * file, off_t size);
 
+// helpers for moving files
+int find_free_space(off_t size);
+int reopen_files(struct flist * file, const char *new_name, int dir_id);
+off_t copy_data(int in, int out, const char **method, const int *cancel);
+// hidden file for the copy of path on dir_id, tmp (PATH_MAX) is
+// its temporary name or "" (O_TMPFILE)
+int move_tmp_open(int dir_id, const char *path, char *tmp);
+// give the copy the name of path, the flist must be wrlocked
+int move_tmp_link(int dir_id, const char *path, int fd, char *tmp);
+// remove an unlinked copy
+void move_tmp_drop(int dir_id, char *tmp);
+
 
 // paths
 char * get_parent_path(const char *path);
 char * get_base_name(const char *path);
 
+// the same in buf of PATH_MAX (no allocation), 0 if it does not fit
+// or there is no parent
+char * path_join(char *buf, const char *dir, const char *file);
+char * path_parent(char *buf, const char *path);
+char * path_base(char *buf, const char *path);
+// path of file on dir_id
+char * dir_path(char *buf, int dir_id, const char *file);
+
 
 // others
-int dir_is_empty(const char *path);
+// path relative to dirfd
+int dir_is_empty(int dirfd, const char *path);
+
+// uid/gid of the process that made the current request
+void get_caller(uid_t *uid, gid_t *gid);
+// set by the backends that have no fuse_get_context (lowlevel)
+void set_caller(uid_t uid, gid_t gid);
 
-#define MOVE_BLOCK_SIZE     32768
+// default size of one copy call while moving files
+#define MOVE_BLOCK_SIZE     (4 * 1024 * 1024)
+#define MOVE_BUF_ALIGN      4096
 
 #endif
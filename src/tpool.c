@@ -0,0 +1,212 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "tpool.h"
+#include "debug.h"
+
+struct tpool_batch
+{
+	tpool_func          fn;
+	void                *data;
+	int                 count;
+	int                 next;       // first job not taken
+	int                 left;       // jobs not finished
+	int                 owned;      // caller has not freed it yet
+	char                *done;
+	pthread_cond_t      cond;
+	struct tpool_batch  *qnext;
+};
+
+// batches with jobs not taken
+static struct tpool_batch *queue = 0, *queue_tail = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static int pool_threads = 0;
+static pthread_t *threads = 0;
+static int stop = 0;
+
+static void queue_del(struct tpool_batch *batch)
+{
+	struct tpool_batch **p, *prev = 0;
+
+	for (p = &queue; *p; prev = *p, p = &(*p)->qnext) {
+		if (*p != batch)
+			continue;
+		*p = batch->qnext;
+		if (queue_tail == batch)
+			queue_tail = prev;
+		batch->qnext = 0;
+		return;
+	}
+}
+
+static void batch_destroy(struct tpool_batch *batch)
+{
+	pthread_cond_destroy(&batch->cond);
+	free(batch->done);
+	free(batch->data);
+	free(batch);
+}
+
+// take a job of the batch (pool_lock is held), -1 if none left
+static int batch_take(struct tpool_batch *batch)
+{
+	if (batch->next >= batch->count)
+		return -1;
+	if (batch->next + 1 == batch->count)
+		queue_del(batch);
+	return batch->next++;
+}
+
+// do job i, pool_lock is held and released while the job runs
+static void batch_run(struct tpool_batch *batch, int i)
+{
+	pthread_mutex_unlock(&pool_lock);
+	batch->fn(batch->data, i);
+	pthread_mutex_lock(&pool_lock);
+
+	batch->done[i] = 1;
+	batch->left--;
+	pthread_cond_broadcast(&batch->cond);
+	if (!batch->left && !batch->owned)
+		batch_destroy(batch);
+}
+
+static void * tpool_thread(void * arg)
+{
+	struct tpool_batch *batch;
+	int i;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (!queue && !stop)
+			pthread_cond_wait(&pool_cond, &pool_lock);
+		/* the queued jobs are done before it stops */
+		if (!queue)
+			break;
+		batch = queue;
+		i = batch_take(batch);
+		batch_run(batch, i);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return 0;
+}
+
+void tpool_init(int count)
+{
+	int i;
+
+	if (count <= 0)
+		return;
+	threads = calloc(count, sizeof(pthread_t));
+	for (i = 0; i < count; i++) {
+		if (pthread_create(threads + i, 0, tpool_thread, 0) != 0) {
+			mhdd_debug(MHDD_MSG,
+				"tpool_init: can not start thread: %s\n",
+				strerror(errno));
+			break;
+		}
+	}
+	pool_threads = i;
+	mhdd_debug(MHDD_INFO, "tpool_init: %d threads\n", pool_threads);
+}
+
+void tpool_stop(void)
+{
+	int i, count;
+
+	pthread_mutex_lock(&pool_lock);
+	stop = 1;
+	count = pool_threads;
+	/* the later batches are done by their callers */
+	pool_threads = 0;
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+
+	for (i = 0; i < count; i++)
+		pthread_join(threads[i], 0);
+	free(threads);
+	threads = 0;
+}
+
+struct tpool_batch * tpool_start(tpool_func fn, void *data, int count)
+{
+	struct tpool_batch *batch = calloc(1, sizeof(struct tpool_batch));
+	int i;
+
+	batch->fn = fn;
+	batch->data = data;
+	batch->count = count;
+	batch->left = count;
+	batch->owned = 1;
+	batch->done = calloc(count ? count : 1, sizeof(char));
+	pthread_cond_init(&batch->cond, 0);
+
+	// nobody to share the work with
+	if (!pool_threads || count < 2) {
+		for (i = 0; i < count; i++) {
+			fn(data, i);
+			batch->done[i] = 1;
+		}
+		batch->next = count;
+		batch->left = 0;
+		return batch;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	if (queue_tail)
+		queue_tail->qnext = batch;
+	else
+		queue = batch;
+	queue_tail = batch;
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+	return batch;
+}
+
+void tpool_wait(struct tpool_batch *batch, int i)
+{
+	int job;
+
+	pthread_mutex_lock(&pool_lock);
+	while (i < 0 ? batch->left : !batch->done[i]) {
+		if ((job = batch_take(batch)) >= 0)
+			batch_run(batch, job);
+		else
+			pthread_cond_wait(&batch->cond, &pool_lock);
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void tpool_free(struct tpool_batch *batch)
+{
+	pthread_mutex_lock(&pool_lock);
+	if (batch->next < batch->count) {
+		queue_del(batch);
+		batch->left -= batch->count - batch->next;
+		batch->next = batch->count;
+	}
+	batch->owned = 0;
+	if (!batch->left)
+		batch_destroy(batch);
+	pthread_mutex_unlock(&pool_lock);
+}
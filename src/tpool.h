@@ -0,0 +1,47 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __TPOOL__H__
+#define __TPOOL__H__
+
+// worker pool for doing the same thing on all the dirs at once
+
+#define TPOOL_DEFAULT_THREADS 8
+
+// job i of the batch
+typedef void (*tpool_func)(void *data, int i);
+
+struct tpool_batch;
+
+// start workers (0 - jobs are done by the caller one by one)
+void tpool_init(int threads);
+
+// finish the queued jobs and stop the workers
+void tpool_stop(void);
+
+// queue count jobs, data is freed (free) with the batch
+struct tpool_batch * tpool_start(tpool_func fn, void *data, int count);
+
+// wait for job i (i < 0 - for all jobs)
+// the caller does the jobs nobody has taken yet itself
+void tpool_wait(struct tpool_batch *batch, int i);
+
+// the caller does not need the batch any more,
+// jobs not started are dropped, running ones free it at the end
+void tpool_free(struct tpool_batch *batch);
+
+#endif
@@ -0,0 +1,370 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "uring.h"
+#include "debug.h"
+
+#ifdef WITH_URING
+
+#include <liburing.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+/*
+   One engine thread owns the ring.  The fuse threads queue their
+   requests and sleep; the engine takes everything queued since the
+   last wakeup, submits it with one io_uring_submit and posts the
+   results.  The wakeup is a read of an eventfd in the same ring, so
+   the engine only ever waits for completions.
+
+   The opened files are registered in the ring by their fd number
+   (slot == fd), so the kernel does not look the fd up on every
+   request.
+*/
+
+#define URING_MAX_FILES 65536
+
+enum { URING_READ, URING_WRITE, URING_FSYNC };
+
+struct uring_req
+{
+	int                 op;
+	int                 fd;
+	void                *buf;
+	size_t              count;
+	off_t               offset;
+	unsigned            flags;
+	int                 res;
+	sem_t               done;
+	struct uring_req    *next;
+};
+
+static struct io_uring ring;
+static int enabled = 0;
+static int wake_fd = -1;
+static uint64_t wake_buf;
+
+static struct uring_req *queue = 0, *queue_tail = 0;
+static int kicked = 0;
+static int stopping = 0;        // nothing is queued after it
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+
+// registered files (slot == fd)
+static int nfiles = 0;
+static char *registered = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct io_uring_sqe * get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	while (!(sqe = io_uring_get_sqe(&ring)))
+		io_uring_submit(&ring);
+	return sqe;
+}
+
+static void arm_wakeup(void)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+	io_uring_prep_read(sqe, wake_fd, &wake_buf, sizeof(wake_buf), 0);
+	io_uring_sqe_set_data(sqe, 0);
+}
+
+static void prep_req(struct uring_req *req)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+
+	switch(req->op) {
+		case URING_READ:
+			io_uring_prep_read(sqe, req->fd, req->buf,
+				req->count, req->offset);
+			break;
+		case URING_WRITE:
+			io_uring_prep_write(sqe, req->fd, req->buf,
+				req->count, req->offset);
+			break;
+		default:
+			io_uring_prep_fsync(sqe, req->fd, req->flags);
+			break;
+	}
+	if (req->fd < nfiles && registered[req->fd])
+		sqe->flags |= IOSQE_FIXED_FILE;
+	io_uring_sqe_set_data(sqe, req);
+}
+
+static void * uring_thread(void * arg)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_req *req, *next;
+	int inflight = 0, stop = 0;
+
+	arm_wakeup();
+	io_uring_submit(&ring);
+
+	// the requests submitted before uring_stop are still completed
+	while (!stop || inflight) {
+		if (io_uring_wait_cqe(&ring, &cqe) != 0)
+			continue;
+		req = io_uring_cqe_get_data(cqe);
+		if (req) {
+			req->res = cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+			sem_post(&req->done);
+			inflight--;
+			continue;
+		}
+
+		// wakeup: submit everything queued meanwhile
+		io_uring_cqe_seen(&ring, cqe);
+		pthread_mutex_lock(&uring_lock);
+		req = queue;
+		queue = queue_tail = 0;
+		kicked = 0;
+		stop = stopping;
+		pthread_mutex_unlock(&uring_lock);
+
+		if (!stop)
+			arm_wakeup();
+		pthread_mutex_lock(&files_lock);
+		for (; req; req = next) {
+			next = req->next;
+			prep_req(req);
+			inflight++;
+		}
+		pthread_mutex_unlock(&files_lock);
+		io_uring_submit(&ring);
+	}
+	return 0;
+}
+
+// the request done by the syscall, once the engine is stopped
+static int plain_req(struct uring_req *req)
+{
+	switch(req->op) {
+		case URING_READ:
+			return pread(req->fd, req->buf, req->count,
+				req->offset);
+		case URING_WRITE:
+			return pwrite(req->fd, req->buf, req->count,
+				req->offset);
+		default:
+			return req->flags ? fdatasync(req->fd) :
+				fsync(req->fd);
+	}
+}
+
+static int uring_do(struct uring_req *req)
+{
+	uint64_t one = 1;
+	int wake = 0;
+
+	req->next = 0;
+
+	pthread_mutex_lock(&uring_lock);
+	if (stopping) {
+		pthread_mutex_unlock(&uring_lock);
+		return plain_req(req);
+	}
+	sem_init(&req->done, 0, 0);
+	if (queue_tail)
+		queue_tail->next = req;
+	else
+		queue = req;
+	queue_tail = req;
+	if (!kicked)
+		wake = kicked = 1;
+	pthread_mutex_unlock(&uring_lock);
+
+	if (wake)
+		write(wake_fd, &one, sizeof(one));
+
+	while (sem_wait(&req->done) != 0)
+		;
+	sem_destroy(&req->done);
+
+	if (req->res < 0) {
+		errno = -req->res;
+		return -1;
+	}
+	return req->res;
+}
+
+void uring_init(int depth)
+{
+	struct rlimit rl;
+	int *files, i, res;
+
+	if (depth <= 0)
+		return;
+
+	if ((res = io_uring_queue_init(depth, &ring, 0)) < 0) {
+		mhdd_debug(MHDD_MSG, "uring_init: io_uring is not available: %s\n",
+			strerror(-res));
+		return;
+	}
+	if ((wake_fd = eventfd(0, 0)) == -1) {
+		mhdd_debug(MHDD_MSG, "uring_init: eventfd: %s\n",
+			strerror(errno));
+		io_uring_queue_exit(&ring);
+		return;
+	}
+
+	// empty file table, one slot per possible fd
+	nfiles = URING_MAX_FILES;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < nfiles)
+		nfiles = rl.rlim_cur;
+	files = malloc(nfiles * sizeof(int));
+	for (i = 0; i < nfiles; i++)
+		files[i] = -1;
+	if ((res = io_uring_register_files(&ring, files, nfiles)) < 0) {
+		mhdd_debug(MHDD_INFO, "uring_init: can not register files: %s\n",
+			strerror(-res));
+		nfiles = 0;
+	} else
+		registered = calloc(nfiles, sizeof(char));
+	free(files);
+
+	if (pthread_create(&thread, 0, uring_thread, 0) != 0) {
+		mhdd_debug(MHDD_MSG, "uring_init: can not start thread: %s\n",
+			strerror(errno));
+		io_uring_queue_exit(&ring);
+		close(wake_fd);
+		nfiles = 0;
+		return;
+	}
+	enabled = 1;
+	mhdd_debug(MHDD_INFO, "uring_init: depth %d, %d file slots\n",
+		depth, nfiles);
+}
+
+void uring_stop(void)
+{
+	uint64_t one = 1;
+
+	if (!enabled)
+		return;
+
+	/* the engine completes what is queued and exits */
+	pthread_mutex_lock(&uring_lock);
+	stopping = 1;
+	pthread_mutex_unlock(&uring_lock);
+	write(wake_fd, &one, sizeof(one));
+	pthread_join(thread, 0);
+
+	pthread_mutex_lock(&files_lock);
+	enabled = 0;
+	nfiles = 0;
+	pthread_mutex_unlock(&files_lock);
+	io_uring_queue_exit(&ring);
+	close(wake_fd);
+	wake_fd = -1;
+	free(registered);
+	registered = 0;
+}
+
+static void set_slot(int fd, int file)
+{
+	if (!enabled || fd < 0 || fd >= nfiles)
+		return;
+
+	pthread_mutex_lock(&files_lock);
+	/* uring_stop may have emptied the table meanwhile */
+	if (fd < nfiles)
+		registered[fd] = io_uring_register_files_update(&ring,
+			fd, &file, 1) == 1 && file != -1;
+	pthread_mutex_unlock(&files_lock);
+}
+
+void uring_register(int fd)
+{
+	set_slot(fd, fd);
+}
+
+void uring_unregister(int fd)
+{
+	set_slot(fd, -1);
+}
+
+ssize_t uring_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	struct uring_req req = { URING_READ, fd, buf, count, offset };
+	if (!enabled)
+		return pread(fd, buf, count, offset);
+	return uring_do(&req);
+}
+
+ssize_t uring_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	struct uring_req req = { URING_WRITE, fd, (void *)buf, count, offset };
+	if (!enabled)
+		return pwrite(fd, buf, count, offset);
+	return uring_do(&req);
+}
+
+int uring_fsync(int fd, int datasync)
+{
+	struct uring_req req = { URING_FSYNC, fd };
+	if (!enabled)
+		return datasync ? fdatasync(fd) : fsync(fd);
+	req.flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+	return uring_do(&req) < 0 ? -1 : 0;
+}
+
+#else
+
+void uring_init(int depth)
+{
+	if (depth > 0)
+		mhdd_debug(MHDD_INFO, "uring_init: built without io_uring\n");
+}
+
+void uring_stop(void)
+{
+}
+
+ssize_t uring_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	return pread(fd, buf, count, offset);
+}
+
+ssize_t uring_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	return pwrite(fd, buf, count, offset);
+}
+
+int uring_fsync(int fd, int datasync)
+{
+	return datasync ? fdatasync(fd) : fsync(fd);
+}
+
+void uring_register(int fd)
+{
+}
+
+void uring_unregister(int fd)
+{
+}
+
+#endif
@@ -0,0 +1,44 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __URING__H__
+#define __URING__H__
+
+#include <sys/types.h>
+
+// io of the opened files through io_uring (make WITH_URING=1),
+// plain syscalls if it is not built in or not supported by the kernel
+
+#define URING_DEFAULT_DEPTH 64
+
+// start the engine (depth 0 - off)
+void uring_init(int depth);
+
+// complete the queued requests and stop the engine, the later ones
+// are plain syscalls
+void uring_stop(void);
+
+// like pread/pwrite/fsync: -1 and errno on error
+ssize_t uring_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t uring_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int uring_fsync(int fd, int datasync);
+
+// fd was opened (or dup2'ed over), fd is going to be closed
+void uring_register(int fd);
+void uring_unregister(int fd);
+
+#endif
@@ -40,6 +40,49 @@ void usage(FILE * to)
 		"                0 - debug\n"
 		"                1 - info\n"
 		"                2 - default messages\n"
+		"  cache_size=N - number of entries in the path location\n"
+		"          cache (0 disables the cache).  Default is 262144\n"
+		"          with watch, 0 without it.\n"
+		"  move_chunk=xxx - size of one copy step while moving\n"
+		"          a file to another disk.  Default is 4Mb.\n"
+		"  move_threads=N - number of threads moving files in\n"
+		"          background (0 - move in the writing thread).\n"
+		"          Default is 0.\n"
+		"  move_timeout=N - seconds a write waits for the file\n"
+		"          to be moved.  Default is 300.\n"
+		"  space_refresh=N - seconds between rereading the free\n"
+		"          space of the disks (0 - on every file creation).\n"
+		"          Default is 0.\n"
+		"  lowlevel - use the inode based fuse interface (known\n"
+		"          objects are not looked up on every call).\n"
+		"  kernel_cache, auto_cache - the fuse page cache options,\n"
+		"          done by mhddfs with lowlevel (auto_cache checks\n"
+		"          mtime and size, watch drops changed files).\n"
+		"  scan_threads=N - threads reading the disks in parallel\n"
+		"          (0 - one by one). Default is 8.\n"
+		"  parallel_lookup - look for a file on all the disks at once\n"
+		"          (uses scan_threads).\n"
+		"  uring_depth=N - io_uring queue depth for reading and writing\n"
+		"          files (0 - plain syscalls). Default is 64.\n"
+		"  placement=NAME - how new files and directories are\n"
+		"          placed: mlimit, roundrobin, mostfree,\n"
+		"          mostfreepct, random, leastbusy.  Default is\n"
+		"          mlimit.\n"
+		"  affinity=N - put new files and directories on the disk\n"
+		"          that has their parent, or an ancestor down to\n"
+		"          depth N, while it has more than mlimit free\n"
+		"          (0 - off).  Default is 0.\n"
+		"  index=/path/to/file - keep the locations of the files\n"
+		"          in this file between mounts.\n"
+		"  index_size=N - number of entries of the index.\n"
+		"          Default is 1048576.\n"
+		"  warmup - read all the disks after mount to fill the\n"
+		"          path cache.\n"
+		"  warmup_rate=N - entries per second each disk is read\n"
+		"          with by the warmup (0 - no limit).  Default is\n"
+		"          5000.\n"
+		"  watch - follow the changes made on the disks directly,\n"
+		"          not through the mount.\n"
 		"\n"
 		" see fusermount(1) for information about other options\n"
 		"";
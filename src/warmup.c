@@ -0,0 +1,228 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "warmup.h"
+#include "pcache.h"
+#include "pindex.h"
+#include "debug.h"
+#include "parse_options.h"
+
+/*
+   The paths found on dir i are offered to the path cache, which takes
+   them only if no earlier dir offered the same path (find_path_dir
+   answers the first dir having it).  So an entry from dir i is only
+   trusted when the crawlers of the dirs before i have finished;
+   until then lookups probe the dirs as usual.
+*/
+
+#define WARMUP_REPORT   100000      // entries between progress messages
+#define WARMUP_BATCH    64          // entries between rate checks
+
+struct crawler
+{
+	int                 dir_id;
+	pthread_t           thread;
+	struct timespec     start;
+	unsigned long long  entries;    // atomic
+	unsigned long long  limit;      // entries to cache (0 - all)
+	int                 complete;   // the whole tree was crawled
+};
+
+static struct crawler *crawlers = 0;
+static int count = 0;
+static int running = 0;
+static int stop = 0;
+static int rate = 0;
+static time_t started = 0;
+static unsigned long long total = 0;
+
+static void throttle(struct crawler *c)
+{
+	struct timespec now, ts;
+	double ahead;
+
+	if (!rate || c->entries % WARMUP_BATCH)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ahead = (double)c->entries / rate - (now.tv_sec - c->start.tv_sec) -
+		(now.tv_nsec - c->start.tv_nsec) / 1e9;
+	if (ahead <= 0)
+		return;
+	ts.tv_sec = ahead;
+	ts.tv_nsec = (ahead - ts.tv_sec) * 1e9;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+// 0 - stopped or the cache share is full
+static int crawl(struct crawler *c, char *path, char *vpath)
+{
+	size_t len = strlen(path);
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int isdir, res = 1;
+	unsigned long long n;
+
+	if (!(dir = opendir(path)))
+		return 1;
+	while (res && (de = readdir(dir))) {
+		if (__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+			res = 0;
+			break;
+		}
+		if (strcmp(de->d_name, ".") == 0 ||
+				strcmp(de->d_name, "..") == 0)
+			continue;
+		if (len + strlen(de->d_name) + 2 > PATH_MAX)
+			continue;
+		path[len] = '/';
+		strcpy(path + len + 1, de->d_name);
+
+		pcache_offer(vpath, c->dir_id);
+		pindex_set(vpath, c->dir_id);
+		__atomic_store_n(&c->entries, c->entries + 1, __ATOMIC_RELAXED);
+		if ((n = __sync_add_and_fetch(&total, 1)) % WARMUP_REPORT == 0)
+			mhdd_debug(MHDD_MSG, "warmup: %llu entries, %d of %d "
+				"dirs left\n", n, running, count);
+		if (c->limit && c->entries >= c->limit) {
+			res = 0;
+			break;
+		}
+		throttle(c);
+
+		isdir = de->d_type == DT_DIR;
+		if (de->d_type == DT_UNKNOWN)
+			isdir = lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+		if (isdir)
+			res = crawl(c, path, vpath);
+	}
+	path[len] = 0;
+	closedir(dir);
+	return res;
+}
+
+static void finish(void)
+{
+	int i;
+
+	/* the entries of a dir are right if the dirs before are crawled */
+	for (i = 0; i < count - 1 && crawlers[i].complete; i++);
+	pcache_offer_done(i);
+	if (i == count - 1 && crawlers[i].complete)
+		pindex_built();
+
+	mhdd_debug(MHDD_MSG, "warmup: %llu entries in %ld s%s\n",
+		total, (long)(time(0) - started),
+		crawlers[i].complete ? "" : ", not complete");
+}
+
+static void * crawler_thread(void *arg)
+{
+	struct crawler *c = arg;
+	char path[PATH_MAX];
+	size_t len = strlen(mhdd.dirs[c->dir_id]);
+
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	if (len < PATH_MAX) {
+		strcpy(path, mhdd.dirs[c->dir_id]);
+		while (len > 1 && path[len - 1] == '/')
+			path[--len] = 0;
+		c->complete = crawl(c, path, path + len);
+	}
+
+	mhdd_debug(MHDD_INFO, "warmup: %s: %llu entries%s\n",
+		mhdd.dirs[c->dir_id], c->entries,
+		c->complete ? "" : ", stopped");
+	if (__sync_sub_and_fetch(&running, 1) == 0 &&
+			!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+		finish();
+	return 0;
+}
+
+void warmup_start(int limit_rate)
+{
+	unsigned long long limit = 0;
+	int i;
+
+	if (crawlers)
+		return;
+
+	/* only the cache is filled: no point to crawl more than it holds */
+	if (pindex_complete()) {
+		if (mhdd.cache_size <= 0) {
+			mhdd_debug(MHDD_MSG, "warmup_start: the path cache "
+				"is off, nothing to warm up\n");
+			return;
+		}
+		limit = mhdd.cache_size / mhdd.cdirs + 1;
+	}
+
+	rate = limit_rate > 0 ? limit_rate : 0;
+	count = mhdd.cdirs;
+	crawlers = calloc(count, sizeof(struct crawler));
+	started = time(0);
+	running = count;
+	for (i = 0; i < count; i++) {
+		crawlers[i].dir_id = i;
+		crawlers[i].limit = limit;
+		if (pthread_create(&crawlers[i].thread, 0, crawler_thread,
+				crawlers + i) != 0) {
+			mhdd_debug(MHDD_MSG, "warmup_start: can not start "
+				"thread: %s\n", strerror(errno));
+			/* the crawlers started so far are stopped */
+			__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+			__sync_sub_and_fetch(&running, count - i);
+			count = i;
+			break;
+		}
+	}
+	mhdd_debug(MHDD_MSG, "warmup_start: %d crawlers, %d entries/s each%s\n",
+		count, rate, limit ? "" : ", building the index");
+}
+
+void warmup_stop(void)
+{
+	int i;
+
+	if (!crawlers)
+		return;
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < count; i++)
+		pthread_join(crawlers[i].thread, 0);
+	count = 0;
+}
+
+int warmup_get_stats(struct warmup_stats *stats)
+{
+	memset(stats, 0, sizeof(struct warmup_stats));
+	if (!crawlers)
+		return 0;
+	stats->entries = __atomic_load_n(&total, __ATOMIC_RELAXED);
+	stats->running = __atomic_load_n(&running, __ATOMIC_RELAXED);
+	stats->seconds = time(0) - started;
+	return 1;
+}
@@ -0,0 +1,44 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WARMUP__H__
+#define __WARMUP__H__
+
+#include <time.h>
+
+// crawl all the dirs after mount, one thread per dir, to fill the path
+// cache and the location index
+
+#define WARMUP_DEFAULT_RATE 5000
+
+struct warmup_stats
+{
+	unsigned long long  entries;
+	int                 running;    // crawlers not finished yet
+	time_t              seconds;    // since the start
+};
+
+// rate - entries per second of every crawler (0 - no limit)
+void warmup_start(int rate);
+
+// stop the crawlers and wait for them
+void warmup_stop(void);
+
+// 0 if the warmup was not started
+int warmup_get_stats(struct warmup_stats *stats);
+
+#endif
@@ -0,0 +1,476 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE     // open_by_handle_at
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+
+#include <uthash.h>
+
+#include "watch.h"
+#include "pcache.h"
+#include "lowlevel.h"
+#include "tools.h"
+#include "debug.h"
+#include "parse_options.h"
+
+/*
+   fanotify marks the whole filesystems of the dirs and reports the
+   changes with the handle of the parent and the name, the changes made
+   by mhddfs itself are skipped by pid.  It needs CAP_SYS_ADMIN; without
+   it every directory of the dirs gets an inotify watch, and the changes
+   of mhddfs come back too (they mostly match the caches already).
+*/
+
+#define WATCH_BUF   65536
+
+#define INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	IN_ATTRIB | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+enum watch_change
+{
+	WATCH_CREATED,
+	WATCH_MOVED_IN,
+	WATCH_GONE,
+	WATCH_MOVED_OUT,
+	WATCH_CHANGED
+};
+
+// inotify watch of one directory
+struct watch_dir
+{
+	int             wd;
+	int             dir_id;
+	char            *path;
+	UT_hash_handle  hh;
+};
+
+static char **roots = 0;            // the dirs without the trailing /
+static const char *method = 0;
+static int fd = -1;
+static unsigned long long events = 0;
+static pthread_t thread;
+static int stop_pipe[2] = {-1, -1};  // closed by watch_stop
+
+static struct watch_dir *wds = 0;   // by wd, only the watch thread
+static int wd_full = 0;
+
+#ifdef FAN_REPORT_DFID_NAME
+static int *mount_fds = 0;
+static fsid_t *fsids = 0;
+#endif
+
+static void changed(int dir_id, const char *path, int what, int isdir)
+{
+	char parent[PATH_MAX];
+
+	mhdd_debug(MHDD_DEBUG, "watch: %s %s on %s\n", path,
+		what == WATCH_CHANGED ? "changed" :
+		what >= WATCH_GONE ? "removed" : "created",
+		mhdd.dirs[dir_id]);
+	__atomic_add_fetch(&events, 1, __ATOMIC_RELAXED);
+
+	if (what == WATCH_CHANGED) {
+		lowlevel_invalidate(path, 0);
+		return;
+	}
+
+	pcache_changed(path, dir_id, what >= WATCH_GONE);
+	/* the paths below a moved dir are cached too */
+	if (isdir && (what == WATCH_MOVED_IN || what == WATCH_MOVED_OUT))
+		pcache_flush();
+	lowlevel_invalidate(path, 1);
+	if (path_parent(parent, path))
+		lowlevel_invalidate(parent, 0);
+}
+
+// all the paths may be wrong
+static void overflow(void)
+{
+	mhdd_debug(MHDD_MSG, "watch: events lost, the path cache is flushed\n");
+	pcache_flush();
+}
+
+// watch the tree under real (path starts at vpath)
+static void add_tree(int dir_id, char *real, char *vpath)
+{
+	size_t len = strlen(real);
+	struct watch_dir *w;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int wd, isdir;
+
+	if ((wd = inotify_add_watch(fd, real, INOTIFY_MASK)) == -1) {
+		if (errno == ENOSPC && !wd_full++)
+			mhdd_debug(MHDD_MSG, "watch: out of inotify watches, "
+				"raise fs.inotify.max_user_watches\n");
+		return;
+	}
+
+	/* a moved dir keeps its watch, the path is renewed */
+	HASH_FIND_INT(wds, &wd, w);
+	if (!w) {
+		w = calloc(1, sizeof(struct watch_dir));
+		w->wd = wd;
+		HASH_ADD_INT(wds, wd, w);
+	}
+	free(w->path);
+	w->path = strdup(*vpath ? vpath : "/");
+	w->dir_id = dir_id;
+
+	if (!(dir = opendir(real)))
+		return;
+	while ((de = readdir(dir))) {
+		if (strcmp(de->d_name, ".") == 0 ||
+				strcmp(de->d_name, "..") == 0)
+			continue;
+		isdir = de->d_type == DT_DIR;
+		if (de->d_type == DT_UNKNOWN) {
+			real[len] = '/';
+			strcpy(real + len + 1, de->d_name);
+			isdir = lstat(real, &st) == 0 && S_ISDIR(st.st_mode);
+		}
+		if (!isdir || len + strlen(de->d_name) + 2 > PATH_MAX)
+			continue;
+		real[len] = '/';
+		strcpy(real + len + 1, de->d_name);
+		add_tree(dir_id, real, vpath);
+	}
+	real[len] = 0;
+	closedir(dir);
+}
+
+static void add_path(int dir_id, const char *path)
+{
+	char real[PATH_MAX];
+	size_t len = strlen(roots[dir_id]);
+
+	if (len + strlen(path) >= PATH_MAX)
+		return;
+	strcpy(real, roots[dir_id]);
+	strcpy(real + len, strcmp(path, "/") == 0 ? "" : path);
+	add_tree(dir_id, real, real + len);
+}
+
+static void inotify_events(char *buf, ssize_t len)
+{
+	struct inotify_event *ev;
+	struct watch_dir *w;
+	char *path;
+	int isdir;
+
+	for (; len > 0; len -= sizeof(*ev) + ev->len,
+			buf += sizeof(*ev) + ev->len) {
+		ev = (struct inotify_event *)buf;
+		if (ev->mask & IN_Q_OVERFLOW) {
+			overflow();
+			continue;
+		}
+		HASH_FIND_INT(wds, &ev->wd, w);
+		if (!w)
+			continue;
+		if (ev->mask & IN_IGNORED) {
+			HASH_DEL(wds, w);
+			free(w->path);
+			free(w);
+			continue;
+		}
+
+		isdir = ev->mask & IN_ISDIR;
+		path = ev->len ? create_path(w->path, ev->name) :
+			strdup(w->path);
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+			changed(w->dir_id, path, ev->mask & IN_DELETE ?
+				WATCH_GONE : WATCH_MOVED_OUT, isdir);
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			changed(w->dir_id, path, ev->mask & IN_CREATE ?
+				WATCH_CREATED : WATCH_MOVED_IN, isdir);
+			if (isdir)
+				add_path(w->dir_id, path);
+		}
+		if (ev->mask & (IN_ATTRIB | IN_CLOSE_WRITE))
+			changed(w->dir_id, path, WATCH_CHANGED, isdir);
+		free(path);
+	}
+}
+
+static int start_inotify(void)
+{
+	int i;
+
+	if ((fd = inotify_init()) == -1) {
+		mhdd_debug(MHDD_MSG, "watch: inotify: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < mhdd.cdirs; i++)
+		add_path(i, "/");
+	method = "inotify";
+	return 0;
+}
+
+#ifdef FAN_REPORT_DFID_NAME
+// dir and the path in it of the real path, -1 if not in the dirs
+static int find_root(const char *real, const char **path)
+{
+	int i, found = -1;
+	size_t len, best = 0;
+
+	for (i = 0; i < mhdd.cdirs; i++) {
+		len = strlen(roots[i]);
+		if (strncmp(real, roots[i], len) != 0 ||
+				(real[len] && real[len] != '/'))
+			continue;
+		if (found < 0 || len > best) {
+			found = i;
+			best = len;
+		}
+	}
+	if (found >= 0)
+		*path = real[best] ? real + best : "/";
+	return found;
+}
+
+static void fanotify_events(char *buf, ssize_t len)
+{
+	struct fanotify_event_metadata *md;
+	struct fanotify_event_info_fid *fid;
+	struct file_handle *fh;
+	char link[64], real[PATH_MAX], *name;
+	const char *path;
+	pid_t self = getpid();
+	ssize_t rlen;
+	int i, dfd, dir_id, isdir;
+
+	for (md = (struct fanotify_event_metadata *)buf;
+			FAN_EVENT_OK(md, len); md = FAN_EVENT_NEXT(md, len)) {
+		if (md->vers != FANOTIFY_METADATA_VERSION)
+			break;
+		if (md->mask & FAN_Q_OVERFLOW) {
+			overflow();
+			continue;
+		}
+		if (md->pid == self)
+			continue;
+
+		fid = (struct fanotify_event_info_fid *)(md + 1);
+		if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+			continue;
+		fh = (struct file_handle *)fid->handle;
+		name = (char *)fh->f_handle + fh->handle_bytes;
+
+		for (i = 0; i < mhdd.cdirs; i++)
+			if (memcmp(fsids + i, &fid->fsid, sizeof(fsid_t)) == 0)
+				break;
+		if (i == mhdd.cdirs)
+			continue;
+
+		/* the parent is gone already: anything may be stale */
+		if ((dfd = open_by_handle_at(mount_fds[i], fh, O_PATH)) == -1) {
+			if (errno == ESTALE)
+				overflow();
+			continue;
+		}
+		snprintf(link, sizeof(link), "/proc/self/fd/%d", dfd);
+		rlen = readlink(link, real, PATH_MAX - 1);
+		close(dfd);
+		if (rlen <= 0)
+			continue;
+		real[rlen] = 0;
+		if (strcmp(name, ".") != 0 && rlen + strlen(name) + 2 <= PATH_MAX)
+			sprintf(real + rlen, "%s%s",
+				real[rlen - 1] == '/' ? "" : "/", name);
+
+		/* the marks are on the whole filesystems */
+		if ((dir_id = find_root(real, &path)) < 0)
+			continue;
+
+		isdir = md->mask & FAN_ONDIR;
+		if (md->mask & (FAN_DELETE | FAN_MOVED_FROM))
+			changed(dir_id, path, md->mask & FAN_DELETE ?
+				WATCH_GONE : WATCH_MOVED_OUT, isdir);
+		if (md->mask & (FAN_CREATE | FAN_MOVED_TO))
+			changed(dir_id, path, md->mask & FAN_CREATE ?
+				WATCH_CREATED : WATCH_MOVED_IN, isdir);
+		if (md->mask & (FAN_ATTRIB | FAN_CLOSE_WRITE))
+			changed(dir_id, path, WATCH_CHANGED, isdir);
+	}
+}
+
+static int start_fanotify(void)
+{
+	uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM |
+		FAN_MOVED_TO | FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_ONDIR;
+	struct statfs st;
+	int i;
+
+	fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME, O_RDONLY);
+	if (fd == -1) {
+		mhdd_debug(MHDD_INFO, "watch: fanotify: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	mount_fds = calloc(mhdd.cdirs, sizeof(int));
+	fsids = calloc(mhdd.cdirs, sizeof(fsid_t));
+	for (i = 0; i < mhdd.cdirs; i++) {
+		mount_fds[i] = open(mhdd.dirs[i], O_RDONLY | O_DIRECTORY);
+		if (mount_fds[i] == -1 || fstatfs(mount_fds[i], &st) == -1 ||
+				fanotify_mark(fd, FAN_MARK_ADD |
+					FAN_MARK_FILESYSTEM, mask,
+					AT_FDCWD, mhdd.dirs[i]) == -1) {
+			mhdd_debug(MHDD_INFO, "watch: fanotify %s: %s\n",
+				mhdd.dirs[i], strerror(errno));
+			break;
+		}
+		fsids[i] = st.f_fsid;
+	}
+	if (i < mhdd.cdirs) {
+		for (; i >= 0; i--)
+			if (mount_fds[i] > 0)
+				close(mount_fds[i]);
+		free(mount_fds);
+		free(fsids);
+		mount_fds = 0;
+		fsids = 0;
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	method = "fanotify";
+	return 0;
+}
+#endif
+
+static void * watch_thread(void *arg)
+{
+	char *buf = malloc(WATCH_BUF);
+	struct pollfd pfd[2] = {{fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+	ssize_t len;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+		if (!pfd[0].revents)
+			continue;
+		len = read(fd, buf, WATCH_BUF);
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			mhdd_debug(MHDD_MSG, "watch: %s: %s, stopped\n",
+				method, len ? strerror(errno) : "closed");
+			break;
+		}
+#ifdef FAN_REPORT_DFID_NAME
+		if (mount_fds) {
+			fanotify_events(buf, len);
+			continue;
+		}
+#endif
+		inotify_events(buf, len);
+	}
+	free(buf);
+	return 0;
+}
+
+void watch_init(void)
+{
+	size_t len;
+	int i;
+
+	if (!mhdd.watch || roots)
+		return;
+
+	roots = calloc(mhdd.cdirs, sizeof(char *));
+	for (i = 0; i < mhdd.cdirs; i++) {
+		roots[i] = strdup(mhdd.dirs[i]);
+		len = strlen(roots[i]);
+		while (len && roots[i][len - 1] == '/')
+			roots[i][--len] = 0;
+	}
+
+#ifdef FAN_REPORT_DFID_NAME
+	if (start_fanotify() != 0)
+#endif
+	if (start_inotify() != 0)
+		return;
+
+	if (pipe(stop_pipe) == -1) {
+		mhdd_debug(MHDD_MSG, "watch_init: pipe: %s\n",
+			strerror(errno));
+		return;
+	}
+	if (pthread_create(&thread, 0, watch_thread, 0) != 0) {
+		mhdd_debug(MHDD_MSG, "watch_init: can not start thread: %s\n",
+			strerror(errno));
+		close(stop_pipe[0]);
+		close(stop_pipe[1]);
+		stop_pipe[0] = stop_pipe[1] = -1;
+		return;
+	}
+	mhdd_debug(MHDD_MSG, "watch_init: watching the dirs with %s\n",
+		method);
+}
+
+void watch_stop(void)
+{
+	if (stop_pipe[1] == -1)
+		return;
+
+	/* closing the watch fd would not wake up a read of it, the hangup
+	   of the pipe wakes up the poll */
+	close(stop_pipe[1]);
+	pthread_join(thread, 0);
+	close(stop_pipe[0]);
+	stop_pipe[0] = stop_pipe[1] = -1;
+	close(fd);
+	fd = -1;
+#ifdef FAN_REPORT_DFID_NAME
+	if (mount_fds) {
+		int i;
+		for (i = 0; i < mhdd.cdirs; i++)
+			close(mount_fds[i]);
+	}
+#endif
+}
+
+int watch_get_stats(const char **how, unsigned long long *count)
+{
+	if (!method)
+		return 0;
+	*how = method;
+	*count = __atomic_load_n(&events, __ATOMIC_RELAXED);
+	return 1;
+}
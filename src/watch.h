@@ -0,0 +1,33 @@
+/*
+   mhddfs - Multi HDD [FUSE] File System
+   Copyright (C) 2008 Dmitry E. Oboukhov <dimka@avanto.org>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WATCH__H__
+#define __WATCH__H__
+
+// watch the dirs for changes made behind mhddfs (-o watch) and drop
+// what the caches know about the changed paths
+
+// start the watching thread (fanotify, or inotify if it is not allowed)
+void watch_init(void);
+
+// stop and join the thread (before the session goes away)
+void watch_stop(void);
+
+// 0 if not watching
+int watch_get_stats(const char **method, unsigned long long *events);
+
+#endif
@@ -0,0 +1,419 @@
+#!/usr/bin/perl
+
+# mounts mhddfs over fresh branches, runs the workloads and prints
+# the results as JSON (make bench)
+
+use warnings;
+use strict;
+
+use Getopt::Std qw(getopts);
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+use POSIX qw(:sys_wait_h);
+
+sub usage()
+{
+    print <<eof;
+    usage: $0 [ OPTIONS ] [ workload ... ]
+
+        OPTIONS:
+
+            -h          - this helpscreen
+            -b N        - number of branches (default 4)
+            -t          - branches on tmpfs (needs root, default for root)
+            -d          - branches are plain directories
+            -o opts     - additional mhddfs options (-o opts)
+            -m path     - mhddfs binary (default ./mhddfs)
+            -s N        - scale of the workloads (default 1)
+            -j N        - parallel jobs of the read/write test (default 4)
+            -f file     - write JSON to file instead of stdout
+
+        workloads: stat_storm open_close seq_rw small_create
+                   readdir_large rename_tree enospc_migration
+eof
+    exit 0;
+}
+
+usage unless getopts('hb:tdo:m:s:j:f:', \my %opts);
+usage if $opts{h};
+
+my $branches = $opts{b} || 4;
+my $tmpfs = $opts{t} ? 1 : $opts{d} ? 0 : $> == 0;
+my $mhddfs = $opts{m} || './mhddfs';
+my $scale = $opts{s} || 1;
+my $jobs = $opts{j} || 4;
+my $extra = $opts{o} || '';
+
+my @all = qw(stat_storm open_close seq_rw small_create
+    readdir_large rename_tree enospc_migration);
+my @workloads = @ARGV ? @ARGV : @all;
+
+die "$mhddfs not found, run make first\n" unless -x $mhddfs;
+die "tmpfs branches need root\n" if $tmpfs and $> != 0;
+
+my $top = tempdir('mhddfs-bench.XXXXXX', TMPDIR => 1, CLEANUP => 0);
+my $mnt = "$top/mnt";
+my @mounted;
+my @dirs;
+
+sub cleanup()
+{
+    system 'fusermount', '-u', $mnt if grep { $_ eq $mnt } @mounted;
+    system 'umount', $_ for grep { $_ ne $mnt } reverse @mounted;
+    @mounted = ();
+    system 'rm', '-fr', $top;
+}
+
+$SIG{INT} = $SIG{TERM} = sub { cleanup; exit 1 };
+END { cleanup if defined $top }
+
+# workload size for the -s scale
+sub scaled($)
+{
+    my $n = int(shift() * $scale);
+    return $n > 0 ? $n : 1;
+}
+
+sub run(@)
+{
+    system(@_) == 0 or die "@_: failed\n";
+}
+
+# run without the messages of mhddfs
+sub quiet(@)
+{
+    my $pid = fork;
+    die "fork: $!\n" unless defined $pid;
+    unless ($pid) {
+        open STDOUT, '>', '/dev/null';
+        open STDERR, '>', '/dev/null';
+        exec @_ or POSIX::_exit(127);
+    }
+    waitpid $pid, 0;
+    die "@_: failed\n" if $?;
+}
+
+# sizes in MB of the branches, 0 - unlimited
+sub make_branches(@)
+{
+    my @sizes = @_;
+    @dirs = ();
+    for my $i (1 .. @sizes) {
+        my $dir = "$top/b$i";
+        mkdir $dir or die "mkdir $dir: $!\n";
+        if ($tmpfs) {
+            my $size = $sizes[$i - 1] ? "$sizes[$i - 1]m" : '50%';
+            run 'mount', '-t', 'tmpfs', '-o', "size=$size", 'tmpfs', $dir;
+            push @mounted, $dir;
+        }
+        push @dirs, $dir;
+    }
+}
+
+sub drop_branches()
+{
+    for my $dir (@dirs) {
+        if (grep { $_ eq $dir } @mounted) {
+            run 'umount', $dir;
+            @mounted = grep { $_ ne $dir } @mounted;
+        }
+        run 'rm', '-fr', $dir;
+    }
+    @dirs = ();
+}
+
+sub mount_fs(@)
+{
+    my $o = join ',', grep { length } @_, $extra;
+    mkdir $mnt unless -d $mnt;
+    quiet $mhddfs, join(',', @dirs), $mnt, ($o ? ('-o', $o) : ());
+    push @mounted, $mnt;
+}
+
+sub umount_fs()
+{
+    run 'fusermount', '-u', $mnt;
+    @mounted = grep { $_ ne $mnt } @mounted;
+}
+
+sub result($$;%)
+{
+    my ($ops, $seconds, %more) = @_;
+    return {
+        ops => $ops,
+        seconds => sprintf('%.6f', $seconds),
+        ops_per_sec => sprintf('%.1f', $seconds > 0 ? $ops / $seconds : 0),
+        %more
+    };
+}
+
+sub write_file($$)
+{
+    my ($name, $size) = @_;
+    open my $fh, '>', $name or die "create $name: $!\n";
+    print $fh 'x' x $size if $size;
+    close $fh or die "close $name: $!\n";
+}
+
+# files are spread over the branches, half of the stats miss
+sub stat_storm()
+{
+    my $count = scaled 1000;
+    for my $d (@dirs) {
+        mkdir "$d/stat" or die "mkdir: $!\n";
+    }
+    for my $i (1 .. $count) {
+        write_file "$dirs[$i % @dirs]/stat/f$i", 0;
+    }
+
+    mount_fs;
+    my $start = time;
+    for my $round (1 .. 10) {
+        for my $i (1 .. $count) {
+            stat "$mnt/stat/f$i" or die "stat f$i: $!\n";
+            stat "$mnt/stat/missing$i";
+        }
+    }
+    my $t = time - $start;
+    umount_fs;
+    return result 20 * $count, $t;
+}
+
+sub open_close()
+{
+    my $count = scaled 20000;
+    write_file "$dirs[-1]/oc", 4096;
+
+    mount_fs;
+    my $start = time;
+    for (1 .. $count) {
+        open my $fh, '<', "$mnt/oc" or die "open: $!\n";
+        close $fh;
+    }
+    my $t = time - $start;
+    umount_fs;
+    return result $count, $t;
+}
+
+sub parallel(&$)
+{
+    my ($code, $count) = @_;
+    my @pids;
+    for my $i (1 .. $count) {
+        my $pid = fork;
+        die "fork: $!\n" unless defined $pid;
+        unless ($pid) {
+            $code->($i);
+            POSIX::_exit(0);
+        }
+        push @pids, $pid;
+    }
+    my $failed = 0;
+    for (@pids) {
+        waitpid $_, 0;
+        $failed++ if $?;
+    }
+    die "$failed jobs failed\n" if $failed;
+}
+
+sub seq_rw()
+{
+    my $mb = scaled 64;
+    my $block = 'x' x 131072;
+
+    mount_fs;
+    my $start = time;
+    parallel {
+        my $i = shift;
+        open my $fh, '>', "$mnt/seq$i" or die "create: $!\n";
+        binmode $fh;
+        syswrite $fh, $block or die "write: $!\n" for 1 .. $mb * 8;
+        close $fh or die "close: $!\n";
+    } $jobs;
+    my $write = time - $start;
+
+    $start = time;
+    parallel {
+        my $i = shift;
+        my $buf;
+        open my $fh, '<', "$mnt/seq$i" or die "open: $!\n";
+        binmode $fh;
+        1 while sysread $fh, $buf, 131072;
+        close $fh;
+    } $jobs;
+    my $read = time - $start;
+    umount_fs;
+
+    return {
+        jobs => $jobs,
+        mbytes => $mb * $jobs,
+        write => result($mb * $jobs * 8, $write,
+            mb_per_sec => sprintf('%.1f', $mb * $jobs / $write)),
+        read => result($mb * $jobs * 8, $read,
+            mb_per_sec => sprintf('%.1f', $mb * $jobs / $read)),
+    };
+}
+
+sub small_create()
+{
+    my $count = scaled 5000;
+
+    mount_fs;
+    my $start = time;
+    for my $i (0 .. $count - 1) {
+        mkdir "$mnt/small" . int($i / 100) unless $i % 100;
+        write_file "$mnt/small" . int($i / 100) . "/f$i", 4096;
+    }
+    my $t = time - $start;
+    umount_fs;
+    return result $count, $t;
+}
+
+sub readdir_large()
+{
+    my $count = scaled 20000;
+    for my $d (@dirs) {
+        mkdir "$d/big" or die "mkdir: $!\n";
+    }
+    for my $i (1 .. $count) {
+        write_file "$dirs[$i % @dirs]/big/f$i", 0;
+    }
+
+    mount_fs;
+    my $start = time;
+    for (1 .. 5) {
+        opendir my $dh, "$mnt/big" or die "opendir: $!\n";
+        my @names = readdir $dh;
+        closedir $dh;
+        die "readdir: " . @names . " entries\n"
+            unless @names == $count + 2;
+    }
+    my $t = time - $start;
+    umount_fs;
+    return result 5, $t, entries => $count;
+}
+
+# files move between dirs, dirs move inside the tree
+sub rename_tree()
+{
+    my $count = scaled 100;
+
+    mount_fs;
+    for my $i (1 .. $count) {
+        mkdir "$mnt/r$i" or die "mkdir: $!\n";
+        write_file "$mnt/r$i/f$_", 0 for 1 .. 10;
+    }
+
+    my $ops = 0;
+    my $start = time;
+    for my $i (1 .. $count) {
+        my $to = $i % $count + 1;
+        for (1 .. 10) {
+            rename "$mnt/r$i/f$_", "$mnt/r$to/g$i-$_"
+                or die "rename: $!\n";
+            $ops++;
+        }
+        rename "$mnt/r$i", "$mnt/r$to/d$i" or die "rename dir: $!\n";
+        $ops++;
+        rename "$mnt/r$to/d$i", "$mnt/r$i" or die "rename back: $!\n";
+        $ops++;
+    }
+    my $t = time - $start;
+    umount_fs;
+    return result $ops, $t;
+}
+
+# the file outgrows the first branch and is moved to the second one
+sub enospc_migration()
+{
+    return { skipped => 'needs tmpfs branches (-t)' } unless $tmpfs;
+
+    my $small = scaled 32;
+    my $block = 'x' x 131072;
+
+    drop_branches;
+    make_branches $small, 8 * $small;
+    mount_fs 'mlimit=10%';
+
+    my $start = time;
+    open my $fh, '>', "$mnt/big" or die "create: $!\n";
+    binmode $fh;
+    syswrite $fh, $block or die "write: $!\n" for 1 .. $small * 16;
+    close $fh or die "close: $!\n";
+    my $t = time - $start;
+    umount_fs;
+
+    my $moved = -e "$dirs[1]/big" && !-e "$dirs[0]/big" ? 1 : 0;
+    drop_branches;
+    make_branches((0) x $branches);
+    return result $small * 16, $t,
+        mbytes => $small * 2,
+        mb_per_sec => sprintf('%.1f', $small * 2 / $t),
+        moved => $moved;
+}
+
+my %bench = (
+    stat_storm          => \&stat_storm,
+    open_close          => \&open_close,
+    seq_rw              => \&seq_rw,
+    small_create        => \&small_create,
+    readdir_large       => \&readdir_large,
+    rename_tree         => \&rename_tree,
+    enospc_migration    => \&enospc_migration,
+);
+
+for (@workloads) {
+    die "unknown workload: $_\n" unless $bench{$_};
+}
+
+sub json($$);
+sub json($$)
+{
+    my ($v, $indent) = @_;
+    my $pad = '    ' x ($indent + 1);
+    if (ref $v eq 'HASH') {
+        return "{\n" . join(",\n", map {
+            "$pad\"$_\": " . json($v->{$_}, $indent + 1)
+        } sort keys %$v) . "\n" . '    ' x $indent . '}';
+    }
+    return $v if $v =~ /^-?\d+(\.\d+)?$/;
+    $v =~ s/(["\\])/\\$1/g;
+    return "\"$v\"";
+}
+
+my $version = `$mhddfs -V 2>&1`;
+$version =~ s/.*:\s*//s;
+chomp $version;
+
+my %results;
+make_branches((0) x $branches);
+for my $w (@workloads) {
+    print STDERR "bench: $w\n";
+    # a failed workload is reported, the others still run
+    $results{$w} = eval { $bench{$w}->() };
+    unless ($results{$w}) {
+        chomp(my $error = $@);
+        umount_fs if grep { $_ eq $mnt } @mounted;
+        $results{$w} = { error => $error };
+    }
+    drop_branches;
+    make_branches((0) x $branches);
+}
+
+my $out = json({
+    version => $version,
+    branches => $branches,
+    backing => $tmpfs ? 'tmpfs' : 'dirs',
+    options => $extra,
+    scale => $scale,
+    time => time,
+    results => \%results,
+}, 0) . "\n";
+
+if ($opts{f}) {
+    open my $fh, '>', $opts{f} or die "$opts{f}: $!\n";
+    print $fh $out;
+    close $fh;
+} else {
+    print $out;
+}
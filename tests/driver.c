@@ -0,0 +1,402 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (C) 2009 Dmitry E. Oboukhov <unera@debian.org>              *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                       *
+ *************************************************************************/
+
+/*
+   calls the handlers of main.c from many threads without a mount:
+   the userspace cost of each operation (path building, flist locking,
+   probing the branches)
+
+   usage: driver [-t threads,...] [-n ops] [-b branches] [-f files]
+                 [-o mhddfs options] [workload ...]
+*/
+
+#define MHDDFS_DRIVER
+#include "../src/main.c"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#define DRIVER_DIR      "/d"
+#define DRIVER_BLOCK    4096
+#define DRIVER_FSIZE    (1024 * DRIVER_BLOCK)
+
+struct driver_thread
+{
+	int                     id;
+	long                    ops;
+	struct fuse_file_info   fi;
+	char                    a[PATH_MAX];
+	char                    b[PATH_MAX];
+	char                    *buf;
+	long                    errors;
+	pthread_t               thread;
+};
+
+struct workload
+{
+	const char  *name;
+	void        (*setup)(struct driver_thread *t);
+	int         (*op)(struct driver_thread *t, long i);
+	void        (*done)(struct driver_thread *t);
+};
+
+static int files = 10000;
+static char **names;
+static pthread_barrier_t barrier;
+static const struct workload *current;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_filler(void *buf, const char *name,
+		const struct stat *st, off_t off)
+{
+	(*(long *)buf)++;
+	return 0;
+}
+
+static int op_stat(struct driver_thread *t, long i)
+{
+	struct stat st;
+	return mhdd_stat(names[(i * 7919 + t->id) % files], &st);
+}
+
+static int op_stat_miss(struct driver_thread *t, long i)
+{
+	struct stat st;
+	snprintf(t->a, PATH_MAX, DRIVER_DIR "/missing.%d.%ld", t->id, i);
+	return mhdd_stat(t->a, &st) == -ENOENT ? 0 : -EEXIST;
+}
+
+static int op_open(struct driver_thread *t, long i)
+{
+	struct fuse_file_info fi = {0};
+	const char *name = names[(i * 7919 + t->id) % files];
+	int res;
+
+	fi.flags = O_RDONLY;
+	res = mhdd_internal_open(name, 0, &fi, OPEN_FUNCION);
+	if (res == 0)
+		res = mhdd_release(name, &fi);
+	return res;
+}
+
+static void setup_file(struct driver_thread *t)
+{
+	t->buf = calloc(1, DRIVER_BLOCK);
+	snprintf(t->a, PATH_MAX, DRIVER_DIR "/data.%d", t->id);
+	memset(&t->fi, 0, sizeof(t->fi));
+	t->fi.flags = O_RDWR | O_CREAT;
+	if (mhdd_internal_open(t->a, 0644, &t->fi, CREATE_FUNCTION) != 0) {
+		fprintf(stderr, "driver: can not create %s\n", t->a);
+		exit(-1);
+	}
+	if (mhdd_ftruncate(t->a, DRIVER_FSIZE, &t->fi) != 0) {
+		fprintf(stderr, "driver: can not truncate %s\n", t->a);
+		exit(-1);
+	}
+}
+
+static void done_file(struct driver_thread *t)
+{
+	mhdd_release(t->a, &t->fi);
+	mhdd_unlink(t->a);
+	free(t->buf);
+}
+
+static int op_read(struct driver_thread *t, long i)
+{
+	off_t off = (i * 7919 % (DRIVER_FSIZE / DRIVER_BLOCK)) * DRIVER_BLOCK;
+	int res = mhdd_read(t->a, t->buf, DRIVER_BLOCK, off, &t->fi);
+	return res == DRIVER_BLOCK ? 0 : res < 0 ? res : -EIO;
+}
+
+static int op_write(struct driver_thread *t, long i)
+{
+	off_t off = (i * 7919 % (DRIVER_FSIZE / DRIVER_BLOCK)) * DRIVER_BLOCK;
+	int res = mhdd_write(t->a, t->buf, DRIVER_BLOCK, off, &t->fi);
+	return res == DRIVER_BLOCK ? 0 : res < 0 ? res : -EIO;
+}
+
+static int op_create(struct driver_thread *t, long i)
+{
+	struct fuse_file_info fi = {0};
+	int res;
+
+	snprintf(t->a, PATH_MAX, DRIVER_DIR "/new.%d.%ld", t->id, i);
+	fi.flags = O_WRONLY | O_CREAT | O_EXCL;
+	if ((res = mhdd_create(t->a, 0644, &fi)) != 0)
+		return res;
+	mhdd_release(t->a, &fi);
+	return mhdd_unlink(t->a);
+}
+
+static int op_mkdir(struct driver_thread *t, long i)
+{
+	int res;
+
+	snprintf(t->a, PATH_MAX, DRIVER_DIR "/dir.%d.%ld", t->id, i);
+	if ((res = mhdd_mkdir(t->a, 0755)) != 0)
+		return res;
+	return mhdd_rmdir(t->a);
+}
+
+static int op_readdir(struct driver_thread *t, long i)
+{
+	long count = 0;
+	int res = mhdd_readdir(DRIVER_DIR, &count, count_filler, 0, 0);
+	return res ? res : count == files + 2 ? 0 : -EIO;
+}
+
+static int op_statfs(struct driver_thread *t, long i)
+{
+	struct statvfs sv;
+	return mhdd_statfs("/", &sv);
+}
+
+// the path helpers alone: the caller buffers and the allocating ones
+static int op_paths(struct driver_thread *t, long i)
+{
+	const char *name = names[(i * 7919 + t->id) % files];
+
+	if (!path_parent(t->a, name) || !dir_path(t->b, t->id % mhdd.cdirs,
+			name) || !path_base(t->a, name))
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+static int op_paths_heap(struct driver_thread *t, long i)
+{
+	const char *name = names[(i * 7919 + t->id) % files];
+	char *parent = get_parent_path(name);
+	char *path = create_path(mhdd.dirs[t->id % mhdd.cdirs], name);
+	char *base = get_base_name(name);
+	int res = parent && path && base ? 0 : -ENOMEM;
+
+	free(parent);
+	free(path);
+	free(base);
+	return res;
+}
+
+static void setup_rename(struct driver_thread *t)
+{
+	struct fuse_file_info fi = {0};
+
+	snprintf(t->a, PATH_MAX, DRIVER_DIR "/ren.%d.a", t->id);
+	snprintf(t->b, PATH_MAX, DRIVER_DIR "/ren.%d.b", t->id);
+	fi.flags = O_WRONLY | O_CREAT;
+	if (mhdd_create(t->a, 0644, &fi) != 0) {
+		fprintf(stderr, "driver: can not create %s\n", t->a);
+		exit(-1);
+	}
+	mhdd_release(t->a, &fi);
+}
+
+static void done_rename(struct driver_thread *t)
+{
+	mhdd_unlink(t->a);
+	mhdd_unlink(t->b);
+}
+
+static int op_rename(struct driver_thread *t, long i)
+{
+	if (i & 1)
+		return mhdd_rename(t->b, t->a);
+	return mhdd_rename(t->a, t->b);
+}
+
+static const struct workload workloads[] = {
+	{ "stat",       0,              op_stat,        0 },
+	{ "stat_miss",  0,              op_stat_miss,   0 },
+	{ "open",       0,              op_open,        0 },
+	{ "read",       setup_file,     op_read,        done_file },
+	{ "write",      setup_file,     op_write,       done_file },
+	{ "create",     0,              op_create,      0 },
+	{ "mkdir",      0,              op_mkdir,       0 },
+	{ "readdir",    0,              op_readdir,     0 },
+	{ "statfs",     0,              op_statfs,      0 },
+	{ "paths",      0,              op_paths,       0 },
+	{ "paths_heap", 0,              op_paths_heap,  0 },
+	{ "rename",     setup_rename,   op_rename,      done_rename },
+	{ 0 }
+};
+
+static void * driver_thread(void *arg)
+{
+	struct driver_thread *t = arg;
+	long i;
+
+	set_caller(getuid(), getgid());
+	if (current->setup)
+		current->setup(t);
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < t->ops; i++)
+		if (current->op(t, i) != 0)
+			t->errors++;
+	pthread_barrier_wait(&barrier);
+	if (current->done)
+		current->done(t);
+	return 0;
+}
+
+static void run(const struct workload *w, int threads, long ops)
+{
+	struct driver_thread *t = calloc(threads, sizeof(*t));
+	double start, elapsed;
+	long errors = 0;
+	int i;
+
+	/* the slow operations do less */
+	if (w->op == op_readdir)
+		ops = ops / 1000 > 0 ? ops / 1000 : 1;
+
+	current = w;
+	pthread_barrier_init(&barrier, 0, threads + 1);
+	for (i = 0; i < threads; i++) {
+		t[i].id = i;
+		t[i].ops = ops;
+		pthread_create(&t[i].thread, 0, driver_thread, t + i);
+	}
+	pthread_barrier_wait(&barrier);
+	start = now();
+	pthread_barrier_wait(&barrier);
+	elapsed = now() - start;
+	for (i = 0; i < threads; i++) {
+		pthread_join(t[i].thread, 0);
+		errors += t[i].errors;
+	}
+	pthread_barrier_destroy(&barrier);
+
+	printf("%-10s %8d %10ld %10.3f %10.1f %12.0f %8ld\n",
+		w->name, threads, ops * threads, elapsed,
+		elapsed * 1e9 / (ops * threads), ops * threads / elapsed,
+		errors);
+	free(t);
+}
+
+static void make_branches(int count, char *top, char *dirs, size_t size)
+{
+	char path[PATH_MAX];
+	int i, fd;
+
+	dirs[0] = 0;
+	for (i = 0; i < count; i++) {
+		snprintf(path, PATH_MAX, "%s/%d", top, i);
+		mkdir(path, 0755);
+		strcat(path, DRIVER_DIR);
+		mkdir(path, 0755);
+		*strrchr(path, '/') = 0;
+		if (i)
+			strncat(dirs, ",", size - strlen(dirs) - 1);
+		strncat(dirs, path, size - strlen(dirs) - 1);
+	}
+
+	/* the files are spread over the branches */
+	names = calloc(files, sizeof(char *));
+	for (i = 0; i < files; i++) {
+		snprintf(path, PATH_MAX, DRIVER_DIR "/file.%d", i);
+		names[i] = strdup(path);
+		snprintf(path, PATH_MAX, "%s/%d%s/file.%d",
+			top, i % count, DRIVER_DIR, i);
+		if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) == -1) {
+			fprintf(stderr, "driver: %s: %s\n", path,
+				strerror(errno));
+			exit(-1);
+		}
+		close(fd);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char top[] = "/tmp/mhddfs-driver.XXXXXX", mnt[PATH_MAX];
+	char dirs[PATH_MAX * 4], *opts = 0, *threads_str = "1,8,32";
+	char *fargv[6], *tok, cmd[PATH_MAX + 16];
+	int c, branches = 4, fargc = 0, i;
+	long ops = 100000;
+	struct fuse_conn_info conn = {0};
+
+	while ((c = getopt(argc, argv, "t:n:b:f:o:h")) != -1) {
+		switch (c) {
+			case 't': threads_str = optarg; break;
+			case 'n': ops = atol(optarg); break;
+			case 'b': branches = atoi(optarg); break;
+			case 'f': files = atoi(optarg); break;
+			case 'o': opts = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-t threads,...] "
+					"[-n ops] [-b branches] [-f files] "
+					"[-o options] [workload ...]\n", argv[0]);
+				return -1;
+		}
+	}
+	if (branches < 2 || files < 1 || ops < 1)
+		return -1;
+
+	if (!mkdtemp(top)) {
+		perror("driver: mkdtemp");
+		return -1;
+	}
+	make_branches(branches, top, dirs, sizeof(dirs));
+	snprintf(mnt, PATH_MAX, "%s/mnt", top);
+	mkdir(mnt, 0755);
+
+	/* the config is made the same way as for a mount */
+	fargv[fargc++] = argv[0];
+	fargv[fargc++] = dirs;
+	fargv[fargc++] = mnt;
+	if (opts) {
+		fargv[fargc++] = "-o";
+		fargv[fargc++] = opts;
+	}
+	fargv[fargc] = 0;
+	mhdd_debug_init();
+	stats_init();
+	parse_options(fargc, fargv);
+	flist_init();
+	pcache_init(mhdd.cache_size);
+	mhdd_init(&conn);
+
+	printf("%-10s %8s %10s %10s %10s %12s %8s\n", "workload",
+		"threads", "ops", "seconds", "ns/op", "ops/s", "errors");
+	for (i = 0; workloads[i].name; i++) {
+		int j, selected = optind >= argc;
+		for (j = optind; j < argc; j++)
+			if (strcmp(argv[j], workloads[i].name) == 0)
+				selected = 1;
+		if (!selected)
+			continue;
+
+		char *list = strdup(threads_str);
+		for (tok = strtok(list, ","); tok; tok = strtok(0, ","))
+			if (atoi(tok) > 0)
+				run(workloads + i, atoi(tok), ops / atoi(tok));
+		free(list);
+	}
+
+	mhdd_destroy(0);
+	snprintf(cmd, sizeof(cmd), "rm -fr %s", top);
+	return system(cmd) == 0 ? 0 : -1;
+}
@@ -0,0 +1,85 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (C) 2009 Dmitry E. Oboukhov <unera@debian.org>              *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                       *
+ *************************************************************************/
+
+/* measures flist lookup latency for a different count of opened files */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/flist.h"
+#include "../src/parse_options.h"
+
+struct mhdd_config mhdd = {0};
+
+#define LOOKUPS 1000000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(int count)
+{
+	struct flist **items = calloc(count, sizeof(struct flist *));
+	uint64_t *ids = calloc(count, sizeof(uint64_t));
+	char name[64];
+	double start, elapsed;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "/file.%d", i);
+		items[i] = flist_create(name, name, 0, -1);
+		ids[i] = items[i]->id;
+		flist_unlock();
+	}
+
+	start = now();
+	for (i = 0; i < LOOKUPS; i++) {
+		struct flist *info = flist_item_by_id(ids[rand() % count]);
+		if (!info) {
+			fprintf(stderr, "lookup failed\n");
+			exit(-1);
+		}
+		flist_unlock();
+	}
+	elapsed = now() - start;
+
+	printf("%8d handles: %8.1f ns/lookup\n",
+		count, elapsed * 1e9 / LOOKUPS);
+
+	for (i = 0; i < count; i++) {
+		flist_wrlock();
+		flist_delete_wrlocked(items[i]);
+	}
+	free(items);
+	free(ids);
+}
+
+int main(int argc, char **argv)
+{
+	mhdd.loglevel = 2;
+	flist_init();
+	bench(10);
+	bench(1000);
+	bench(100000);
+	return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# listing time of a directory against number of drives and entries,
+# drives are read one by one (scan_threads=0) and in parallel
+#
+# usage: readdir_bench.sh [branches...] -- [entries...]
+
+branches="1 2 4 8"
+entries="1000 10000 50000"
+threads="0 8"
+
+if test -n "$1"; then
+    branches=""
+    while test -n "$1" -a "$1" != "--"; do branches="$branches $1"; shift; done
+    if test "$1" == "--"; then shift; entries="$*"; fi
+fi
+
+top=`mktemp -d`
+mnt=$top/mnt
+mkdir $mnt
+
+cleantemp() {
+    fusermount -u $mnt 2> /dev/null
+    rm -fr $top
+}
+trap cleantemp EXIT
+
+printf "%8s %8s %8s %10s\n" branches entries threads seconds
+
+for b in $branches; do
+    for e in $entries; do
+        dirs=""
+        for i in `seq $b`; do
+            mkdir -p $top/$b-$e/$i/dir
+            dirs="$dirs,$top/$b-$e/$i"
+        done
+        # spread the entries among the drives
+        for i in `seq $e`; do
+            echo -n > $top/$b-$e/$(( i % b + 1 ))/dir/file$i
+        done
+
+        for t in $threads; do
+            ./mhddfs ${dirs#,} $mnt -o scan_threads=$t > /dev/null || exit 1
+            ls -f $mnt/dir > /dev/null
+            start=`date +%s.%N`
+            for i in 1 2 3; do
+                ls -f $mnt/dir > /dev/null
+            done
+            end=`date +%s.%N`
+            fusermount -u $mnt
+            printf "%8d %8d %8d %10.3f\n" $b $e $t \
+                `echo "($end - $start) / 3" | bc -l`
+        done
+        rm -fr $top/$b-$e
+    done
+done
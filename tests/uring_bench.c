@@ -0,0 +1,118 @@
+/*************************************************************************
+ *                                                                       *
+ * Copyright (C) 2009 Dmitry E. Oboukhov <unera@debian.org>              *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ *                                                                       *
+ *************************************************************************/
+
+/* random 4k reads and writes through the io engine at queue depth
+   1, 8 and 64 (threads), plain syscalls first, then io_uring */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../src/uring.h"
+#include "../src/parse_options.h"
+
+struct mhdd_config mhdd = {0};
+
+#define FILE_SIZE   (64 * 1024 * 1024)
+#define BLOCK       4096
+#define SECONDS     2
+
+static int fd;
+static volatile int stop;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void * worker(void *arg)
+{
+	long long *bytes = arg;
+	unsigned int seed = (unsigned long)arg;
+	char buf[BLOCK];
+	off_t off;
+
+	memset(buf, 'x', BLOCK);
+	while (!stop) {
+		off = (off_t)(rand_r(&seed) % (FILE_SIZE / BLOCK)) * BLOCK;
+		if (rand_r(&seed) & 1) {
+			if (uring_pread(fd, buf, BLOCK, off) != BLOCK)
+				break;
+		} else {
+			if (uring_pwrite(fd, buf, BLOCK, off) != BLOCK)
+				break;
+		}
+		*bytes += BLOCK;
+	}
+	return 0;
+}
+
+static void bench(const char *mode, int qd)
+{
+	pthread_t *threads = calloc(qd, sizeof(pthread_t));
+	long long *bytes = calloc(qd, sizeof(long long)), total = 0;
+	double start;
+	int i;
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < qd; i++)
+		pthread_create(threads + i, 0, worker, bytes + i);
+	sleep(SECONDS);
+	stop = 1;
+	for (i = 0; i < qd; i++) {
+		pthread_join(threads[i], 0);
+		total += bytes[i];
+	}
+
+	printf("%-8s %4d %10.1f MB/s\n", mode, qd,
+		total / (now() - start) / (1024 * 1024));
+	free(threads);
+	free(bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "uring_bench.dat";
+	int depths[] = { 1, 8, 64 }, i;
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || ftruncate(fd, FILE_SIZE) != 0) {
+		perror(name);
+		return 1;
+	}
+	unlink(name);
+
+	for (i = 0; i < 3; i++)
+		bench("syscall", depths[i]);
+
+	uring_init(URING_DEFAULT_DEPTH);
+	uring_register(fd);
+	for (i = 0; i < 3; i++)
+		bench("uring", depths[i]);
+
+	close(fd);
+	return 0;
+}